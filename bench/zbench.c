@@ -0,0 +1,509 @@
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zio.h>
+#include <zlexer.h>
+#include <zpreprocessor.h>
+
+/* Lexer micro-benchmarks over synthetic corpora. Every function is timed a
+ * few times on the same input and the best run is reported as JSON on the
+ * standard output, in MB/s and tokens/s. Files given on the command line
+ * are benchmarked as extra corpora. */
+
+#ifndef ZBENCH_SIZE
+#define ZBENCH_SIZE 0x400000
+#endif
+
+#ifndef ZBENCH_RUNS
+#define ZBENCH_RUNS 5
+#endif
+
+#define ZBENCH_LINE 72
+
+extern double zbench_now(void);
+
+struct zbench_corpus {
+    const char* name;
+    char* text;
+    size_t size;
+};
+
+struct zbench_result {
+    size_t bytes;
+    size_t tokens;
+};
+
+typedef struct zbench_result (*zbench_fn)(const struct zbench_corpus*);
+typedef char* (*zbench_scanner)(const char*);
+
+/* Corpus generation, deterministic so runs compare */
+
+static unsigned long zbench_seed = 0x2545f491;
+
+static unsigned long zbench_rand(const unsigned long n)
+{
+    zbench_seed ^= zbench_seed << 13;
+    zbench_seed ^= zbench_seed >> 17;
+    zbench_seed ^= zbench_seed << 5;
+    zbench_seed &= 0xffffffff;
+    return zbench_seed % n;
+}
+
+static const char* zbench_pick(const char** words, const size_t count)
+{
+    return words[zbench_rand(count)];
+}
+
+static const char* zbench_keywords[] = {
+    "int", "char", "unsigned", "const", "static", "struct", "return", "if",
+    "else", "while", "for", "void", "sizeof", "long", "switch", "case"
+};
+
+static const char* zbench_ops[] = {
+    "+", "-", "*", "/", "=", "==", "!=", "<=", ">=", "<<", ">>=", "&&",
+    "||", "->", ".", ",", ";", "?", ":", "++", "--", "&", "|", "^", "~"
+};
+
+static const char* zbench_escapes[] = {
+    "\\n", "\\t", "\\\"", "\\\\", "\\x41", "\\0", "\\177", "\\'"
+};
+
+static const char* zbench_suffixes[] = {
+    "", "", "", "u", "U", "l", "L", "ul", "UL", "ll", "ull"
+};
+
+static void zbench_putc(struct string* out, const char c)
+{
+    char s[2];
+    s[0] = c;
+    s[1] = 0;
+    string_push(out, s);
+}
+
+static void zbench_ident(struct string* out)
+{
+    static const char head[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+    static const char tail[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+    size_t i, len;
+    if (!zbench_rand(8)) {
+        string_push(out, zbench_pick(zbench_keywords, sizeof(zbench_keywords) / sizeof(char*)));
+        return;
+    }
+
+    len = 1 + zbench_rand(16);
+    zbench_putc(out, head[zbench_rand(sizeof(head) - 1)]);
+    for (i = 1; i < len; ++i) {
+        zbench_putc(out, tail[zbench_rand(sizeof(tail) - 1)]);
+    }
+}
+
+static void zbench_number(struct string* out)
+{
+    static const char hex[] = "0123456789abcdefABCDEF";
+    size_t i, len = 1 + zbench_rand(10);
+    switch (zbench_rand(4)) {
+    case 0:
+        string_push(out, "0x");
+        for (i = 0; i < len; ++i) {
+            zbench_putc(out, hex[zbench_rand(sizeof(hex) - 1)]);
+        }
+        break;
+    case 1:
+        zbench_putc(out, (char)('0' + zbench_rand(10)));
+        zbench_putc(out, '.');
+        for (i = 0; i < len; ++i) {
+            zbench_putc(out, (char)('0' + zbench_rand(10)));
+        }
+        string_push(out, zbench_rand(2) ? "e-" : "E+");
+        zbench_putc(out, (char)('1' + zbench_rand(9)));
+        string_push(out, zbench_rand(2) ? "f" : "");
+        return;
+    default:
+        zbench_putc(out, (char)('1' + zbench_rand(9)));
+        for (i = 1; i < len; ++i) {
+            zbench_putc(out, (char)('0' + zbench_rand(10)));
+        }
+    }
+    string_push(out, zbench_pick(zbench_suffixes, sizeof(zbench_suffixes) / sizeof(char*)));
+}
+
+static void zbench_string(struct string* out)
+{
+    static const char text[] = "abcdefghijklmnopqrstuvwxyz ,.:;!?%()[]{}0123456789";
+    size_t i, len;
+    if (!zbench_rand(4)) {
+        zbench_putc(out, '\'');
+        if (zbench_rand(3)) {
+            zbench_putc(out, text[zbench_rand(26)]);
+        }
+        else string_push(out, zbench_pick(zbench_escapes, sizeof(zbench_escapes) / sizeof(char*)));
+        zbench_putc(out, '\'');
+        return;
+    }
+
+    len = zbench_rand(40);
+    zbench_putc(out, '"');
+    for (i = 0; i < len; ++i) {
+        if (!zbench_rand(12)) {
+            string_push(out, zbench_pick(zbench_escapes, sizeof(zbench_escapes) / sizeof(char*)));
+        }
+        else zbench_putc(out, text[zbench_rand(sizeof(text) - 1)]);
+    }
+    zbench_putc(out, '"');
+}
+
+/* Returns 1 for a line comment, which has to end the line */
+static int zbench_comment(struct string* out)
+{
+    const int block = (int)zbench_rand(2);
+    size_t len = 2 + zbench_rand(10);
+    string_push(out, block ? "/* " : "// ");
+    while (len--) {
+        zbench_ident(out);
+        zbench_putc(out, ' ');
+    }
+    string_push(out, block ? "*/" : "");
+    return !block;
+}
+
+/* Brackets are always closed on the line they open so zcc_lexparen never
+ * runs away over the rest of the corpus */
+static void zbench_code(struct string* out, const size_t depth)
+{
+    switch (zbench_rand(depth < 2 ? 9 : 6)) {
+    case 0: case 1:
+        zbench_ident(out);
+        break;
+    case 2:
+        zbench_number(out);
+        break;
+    case 3:
+        zbench_string(out);
+        break;
+    case 4: case 5:
+        string_push(out, zbench_pick(zbench_ops, sizeof(zbench_ops) / sizeof(char*)));
+        break;
+    default: {
+        static const char* brackets[] = {"()", "[]", "{}"};
+        const char* b = brackets[zbench_rand(3)];
+        size_t len = zbench_rand(4);
+        zbench_putc(out, b[0]);
+        while (len--) {
+            zbench_code(out, depth + 1);
+            zbench_putc(out, ' ');
+        }
+        zbench_putc(out, b[1]);
+    }
+    }
+}
+
+/* Appends a word of the named corpus, returns 1 if it ends the line */
+static int zbench_word(struct string* out, const char* name)
+{
+    switch (*name) {
+    case 'i':
+        zbench_ident(out);
+        break;
+    case 'n':
+        zbench_number(out);
+        break;
+    case 's':
+        zbench_string(out);
+        break;
+    case 'c':
+        if (zbench_rand(4)) {
+            return zbench_comment(out);
+        }
+        zbench_code(out, 0);
+        break;
+    default:
+        if (!zbench_rand(16)) {
+            return zbench_comment(out);
+        }
+        zbench_code(out, 0);
+    }
+    return 0;
+}
+
+/* Lines are indented, never blank and never end in a blank, the line
+ * based tokenizers stop at either */
+static struct zbench_corpus zbench_corpus_create(const char* name, const size_t size)
+{
+    size_t line;
+    int end;
+    struct zbench_corpus corpus;
+    struct string out = string_empty();
+
+    while (out.size < size) {
+        line = out.size;
+        string_push(&out, zbench_rand(2) ? "    " : "");
+        end = zbench_word(&out, name);
+        while (!end && out.size - line < ZBENCH_LINE) {
+            zbench_putc(&out, ' ');
+            end = zbench_word(&out, name);
+        }
+        while (out.data[out.size - 1] == ' ') {
+            --out.size;
+        }
+        zbench_putc(&out, '\n');
+    }
+
+    corpus.name = name;
+    corpus.text = out.data;
+    corpus.size = out.size;
+    return corpus;
+}
+
+/* Benchmarked functions, each returns the bytes and tokens it went through */
+
+static struct zbench_result zbench_tokenize(const struct zbench_corpus* corpus)
+{
+    struct zbench_result res;
+    struct vector tokens = zcc_tokenize(corpus->text);
+    const struct token* last = vector_peek(&tokens);
+    res.tokens = tokens.size;
+    res.bytes = last ? (size_t)(last->str + last->len - corpus->text) : 0;
+    vector_free(&tokens);
+    return res;
+}
+
+static struct zbench_result zbench_tokenize_text(const struct zbench_corpus* corpus)
+{
+    struct zbench_result res;
+    struct tokarray tokens = zcc_tokenize_text(corpus->text);
+    res.tokens = tokens.size - 1;
+    res.bytes = corpus->size;
+    ztoks_free(&tokens);
+    return res;
+}
+
+static struct zbench_result zbench_lex(const struct zbench_corpus* corpus)
+{
+    unsigned int len, type;
+    const char* str = corpus->text, *end = corpus->text + corpus->size;
+    struct zbench_result res;
+    res.tokens = 0;
+
+    /* zcc_lex stops at the end of each line */
+    while (str < end) {
+        const char* tok = zcc_lex(str, &len, &type);
+        if (!tok) {
+            str = zcc_lexline(str);
+            str += *str == '\n';
+            continue;
+        }
+        str = tok + len;
+        ++res.tokens;
+    }
+
+    res.bytes = corpus->size;
+    return res;
+}
+
+static struct zbench_result zbench_preprocess_text(const struct zbench_corpus* corpus)
+{
+    struct zbench_result res;
+    size_t size = corpus->size;
+    char* text = zmalloc(size + 1);
+    zmemcpy(text, corpus->text, size + 1);
+
+    zcc_preprocess_text(corpus->name, text, &size, NULL);
+    res.bytes = corpus->size;
+    res.tokens = 0;
+    zfree(text);
+    return res;
+}
+
+/* Single scanners are timed on every position of the corpus they apply
+ * to, found beforehand with the table lexer, so only the scanner runs */
+
+enum zbench_scan {
+    ZBENCH_LEXNONE,
+    ZBENCH_LEXLINE,
+    ZBENCH_LEXSPACE,
+    ZBENCH_LEXSTR,
+    ZBENCH_LEXPAREN,
+    ZBENCH_LEXID,
+    ZBENCH_LEXNUM,
+    ZBENCH_LEXOP,
+    ZBENCH_SCANS
+};
+
+static const char* zbench_scan_names[ZBENCH_SCANS] = {
+    "zcc_lexnone", "zcc_lexline", "zcc_lexspace", "zcc_lexstr",
+    "zcc_lexparen", "zcc_lexid", "zcc_lexnum", "zcc_lexop"
+};
+
+static const zbench_scanner zbench_scanners[ZBENCH_SCANS] = {
+    &zcc_lexnone, &zcc_lexline, &zcc_lexspace, &zcc_lexstr,
+    &zcc_lexparen, &zcc_lexid, &zcc_lexnum, &zcc_lexop
+};
+
+static struct vector zbench_starts[ZBENCH_SCANS];
+static enum zbench_scan zbench_scan;
+
+static void zbench_scan_starts(const struct zbench_corpus* corpus)
+{
+    size_t i;
+    char* end;
+    unsigned int type;
+    const char* str = corpus->text, *line = str;
+
+    for (i = 0; i < ZBENCH_SCANS; ++i) {
+        zbench_starts[i] = vector_create(sizeof(const char*));
+    }
+
+    vector_push(zbench_starts + ZBENCH_LEXLINE, &line);
+    while ((end = zlex_next(str, &type))) {
+        switch (type) {
+        case ZTOK_NON:
+            if (*str == ' ' || *str == '\t') {
+                vector_push(zbench_starts + ZBENCH_LEXNONE, &str);
+                vector_push(zbench_starts + ZBENCH_LEXSPACE, &str);
+            }
+            line = zmemchr(str, '\n', end - str);
+            while (line) {
+                ++line;
+                vector_push(zbench_starts + ZBENCH_LEXLINE, &line);
+                line = zmemchr(line, '\n', end - line);
+            }
+            break;
+        case ZTOK_STR:
+            vector_push(zbench_starts + ZBENCH_LEXSTR, &str);
+            break;
+        case ZTOK_ID:
+            vector_push(zbench_starts + ZBENCH_LEXID, &str);
+            break;
+        case ZTOK_NUM:
+            vector_push(zbench_starts + ZBENCH_LEXNUM, &str);
+            break;
+        default:
+            if (_isparen(*str)) {
+                vector_push(zbench_starts + ZBENCH_LEXPAREN, &str);
+            }
+            vector_push(zbench_starts + ZBENCH_LEXOP, &str);
+        }
+        str = end;
+    }
+}
+
+static void zbench_scan_free(void)
+{
+    size_t i;
+    for (i = 0; i < ZBENCH_SCANS; ++i) {
+        vector_free(zbench_starts + i);
+    }
+}
+
+/* A scanner returning NULL found nothing to consume */
+static struct zbench_result zbench_scanner_run(const struct zbench_corpus* corpus)
+{
+    size_t i;
+    struct zbench_result res;
+    const zbench_scanner scanner = zbench_scanners[zbench_scan];
+    const char** starts = zbench_starts[zbench_scan].data;
+    res.bytes = 0;
+    res.tokens = zbench_starts[zbench_scan].size;
+    for (i = 0; i < res.tokens; ++i) {
+        const char* end = scanner(starts[i]);
+        res.bytes += end ? (size_t)(end - starts[i]) : 0;
+    }
+    (void)corpus;
+    return res;
+}
+
+/* Timing and JSON output */
+
+static int zbench_first = 1;
+
+static void zbench_rate(const char* key, const double rate)
+{
+    const size_t cents = (size_t)(rate * 100.0 + 0.5);
+    zcc_log(", \"%s\": %zu.%02zu", key, cents / 100, cents % 100);
+}
+
+static void zbench_run(const struct zbench_corpus* corpus, const char* name, zbench_fn fn, size_t tokens)
+{
+    int i;
+    double t, best = 0.0;
+    struct zbench_result res;
+    res.bytes = res.tokens = 0;
+
+    for (i = 0; i < ZBENCH_RUNS; ++i) {
+        t = zbench_now();
+        res = fn(corpus);
+        t = zbench_now() - t;
+        if (!i || t < best) {
+            best = t;
+        }
+    }
+
+    if (best <= 0.0) {
+        best = 1e-9;
+    }
+
+    tokens = res.tokens ? res.tokens : tokens;
+    zcc_log("%s\n    {\"corpus\": \"%s\", \"function\": \"%s\"", zbench_first ? "" : ",", corpus->name, name);
+    zcc_log(", \"bytes\": %zu, \"tokens\": %zu, \"usec\": %zu", res.bytes, tokens, (size_t)(best * 1e6));
+    zbench_rate("mb_per_s", (double)res.bytes / best / 1e6);
+    zbench_rate("tokens_per_s", (double)tokens / best);
+    zcc_log("}");
+    zbench_first = 0;
+}
+
+static void zbench_corpus_run(const struct zbench_corpus* corpus)
+{
+    size_t i, tokens;
+    struct zbench_result res = zbench_tokenize_text(corpus);
+    tokens = res.tokens;
+
+    zbench_run(corpus, "zcc_tokenize", &zbench_tokenize, 0);
+    zbench_run(corpus, "zcc_tokenize_text", &zbench_tokenize_text, 0);
+    zbench_run(corpus, "zcc_lex", &zbench_lex, 0);
+
+    zbench_scan_starts(corpus);
+    for (i = 0; i < ZBENCH_SCANS; ++i) {
+        zbench_scan = (enum zbench_scan)i;
+        if (zbench_starts[i].size) {
+            zbench_run(corpus, zbench_scan_names[i], &zbench_scanner_run, 0);
+        }
+    }
+    zbench_scan_free();
+
+    /* preprocess_text does not count tokens, report the lexer's count */
+    zbench_run(corpus, "zcc_preprocess_text", &zbench_preprocess_text, tokens);
+}
+
+int main(const int argc, const char** argv)
+{
+    int i;
+    size_t size;
+    static const char* names[] = {"identifier", "number", "string", "comment", "mixed"};
+    const int count = (int)(sizeof(names) / sizeof(names[0]));
+    struct zbench_corpus corpus;
+    struct vector files = vector_create(sizeof(struct zbench_corpus));
+
+    for (i = 1; i < argc; ++i) {
+        corpus.name = argv[i];
+        corpus.text = zcc_fread(argv[i], &size);
+        if (!corpus.text) {
+            zcc_log("zbench could not open file '%s'.\n", argv[i]);
+            return Z_EXIT_FAILURE;
+        }
+        corpus.size = size;
+        vector_push(&files, &corpus);
+    }
+
+    zcc_log("{\"runs\": %d, \"results\": [", ZBENCH_RUNS);
+    for (i = 0; i < count + (int)files.size; ++i) {
+        if (i < count) {
+            corpus = zbench_corpus_create(names[i], ZBENCH_SIZE);
+        }
+        else corpus = ((struct zbench_corpus*)files.data)[i - count];
+        zbench_corpus_run(&corpus);
+        zfree(corpus.text);
+    }
+    zcc_log("\n]}\n");
+
+    vector_free(&files);
+    return Z_EXIT_SUCCESS;
+}
@@ -0,0 +1,12 @@
+/* Wall clock for the benchmarks. Kept apart from zbench.c since it needs
+ * the system headers instead of zlibc's. */
+
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+
+double zbench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
@@ -16,6 +16,7 @@ flags=(
     -Izlibc/src/include
     -Iutopia
     -Isrc
+    -Itmp
 )
 
 nostd=(
@@ -60,9 +61,16 @@ checkargs() {
     done
 }
 
+gen() {
+    cmd $cc tools/zkindgen.c -o $tmpdir/zkindgen -I$srcdir
+    echo "$tmpdir/zkindgen > $tmpdir/zkindhash.h"
+    $tmpdir/zkindgen > $tmpdir/zkindhash.h || exit
+}
+
 comp() {
     checkargs zlibc utopia
     cmd mkdir -p $tmpdir
+    gen
     cmd $cc -c $src ${flags[*]}
     cmd mv *.o $tmpdir/
     cmd $cc $tmpdir/*.o -o $name ${nostd[*]} -e $entry -L$libdir ${libs[*]} ${oslib[*]}
@@ -5,13 +5,19 @@
 #include <zlexer.h>
 #include <zparser.h>
 #include <zpreprocessor.h>
+#include <zstream.h>
+#include <zatom.h>
+#include <zthread.h>
+#include <zheader.h>
+#include <zinclude.h>
 #include <zassert.h>
 
 extern int zcc_precomments;
 extern int zcc_printdefines;
+extern int zcc_lexthreads;
 extern void zmalloc_inspect(void);
 
-static int zcc_defines_define(struct map* defines, const char* str)
+static int zcc_defines_define(struct zmacros* defines, const char* str)
 {
     char* eq, *s;
     struct token tok = ztok_get(str);
@@ -28,22 +34,42 @@ static int zcc_defines_define(struct map* defines, const char* str)
     return zcc_defines_push(defines, s, "1");
 }
 
+static int zcc_dump_tokens(const char* path)
+{
+    struct token tok;
+    struct zstream stream;
+    if (zstream_open(&stream, path)) {
+        return Z_EXIT_FAILURE;
+    }
+
+    tok = zstream_next(&stream);
+    while (tok.str) {
+        const unsigned int len = tok.len < 0xfff ? tok.len : 0xfff;
+        zcc_log("%s '%s'\n", zkind_str(tok.kind), zstrbuf(tok.str, len));
+        tok = zstream_next(&stream);
+    }
+
+    zstream_close(&stream);
+    return Z_EXIT_SUCCESS;
+}
+
 int main(const int argc, const char** argv)
 {
     size_t len;
     char* src;
-    const char* null = NULL, **filepaths;
+    const char* null = NULL, **filepaths, *pchout = NULL;
     int i, filecount, status = Z_EXIT_SUCCESS;
-    int ppprint = 0, printdefs = 0, preproc = 1;
+    int ppprint = 0, printdefs = 0, preproc = 1, dumptoks = 0;
     
     struct vector infiles, includes;
-    struct map defines = zcc_defines_std();
+    struct zmacros defines = zcc_defines_std();
 
     infiles = vector_create(sizeof(char*));
     includes = zcc_includes_std();
 
     for (i = 1; i < argc; ++i) {
-        if (argv[i][0] == '-') {
+        /* a lone "-" is standard input */
+        if (argv[i][0] == '-' && argv[i][1]) {
             if (argv[i][1] == 'I') {
                 const char* ptr = argv[i] + 2;
                 vector_push(&includes, &ptr);
@@ -68,15 +94,41 @@ int main(const int argc, const char** argv)
             else if (argv[i][1] == 'C') {
                 zcc_precomments = 0;
             }
+            else if (argv[i][1] == 'j') {
+                /* lexing threads, -j alone takes every hardware thread */
+                const char* ptr = argv[i] + 2;
+                zcc_lexthreads = *ptr ? 0 : (int)zthread_count();
+                while (_isdigit(*ptr)) {
+                    zcc_lexthreads = zcc_lexthreads * 10 + *ptr++ - '0';
+                }
+            }
             else if (argv[i][1] == 'd' && argv[i][2] == 'M') {
                 printdefs = 1;
             }
             else if (!zstrcmp(argv[i] + 1, "undef")) {
-                zcc_defines_free(&defines, 0);
+                zcc_defines_free(&defines);
+                defines = zcc_defines_create();
+            }
+            else if (!zstrcmp(argv[i] + 1, "emit-pch") || !zstrcmp(argv[i] + 1, "include-pch")) {
+                if (i == argc - 1) {
+                    zcc_log("Missing input for option '%s'.\n", argv[i]);
+                    status = Z_EXIT_FAILURE;
+                    goto exit;
+                }
+                if (argv[i][1] == 'e') {
+                    pchout = argv[++i];
+                }
+                else if (zcc_pch_load(argv[++i], &defines)) {
+                    status = Z_EXIT_FAILURE;
+                    goto exit;
+                }
             }
             else if (!zstrcmp(argv[i] + 1, "fpreprocessed")) {
                 preproc = 0;
             }
+            else if (!zstrcmp(argv[i] + 1, "dump-tokens")) {
+                dumptoks = 1;
+            }
         } 
         else vector_push(&infiles, &argv[i]);
     }
@@ -89,6 +141,13 @@ int main(const int argc, const char** argv)
         goto exit;
     }
 
+    /* every input would write over the same file */
+    if (pchout && infiles.size > 1) {
+        zcc_log("Option -emit-pch takes a single input file.\n");
+        status = Z_EXIT_FAILURE;
+        goto exit;
+    }
+
     if (ppprint && printdefs) {
         zcc_printdefines = 1;
         ppprint = 0;
@@ -99,31 +158,62 @@ int main(const int argc, const char** argv)
     filepaths = infiles.data;
     filecount = (int)infiles.size;
     for (i = 0; i < filecount; ++i) {
-        src = zcc_fread(filepaths[i], &len);
-        if (src) {
+        struct zbuf file;
+        if (dumptoks) {
+            /* streamed in chunks, never holds the whole file */
+            if (zcc_dump_tokens(filepaths[i])) {
+                zcc_log("zcc could not open translation unit '%s'.\n", filepaths[i]);
+            }
+            continue;
+        }
+
+        file = zcc_fmap(filepaths[i]);
+        if (file.data) {
             struct treenode* ast;
-            src = zcc_preprocess_text(src, &len);
+            const char* name = zstrcmp(filepaths[i], "-") ? filepaths[i] : "<stdin>";
+            struct zsrcmap map = zsrcmap_create(name);
+            len = file.size;
+            src = zcc_preprocess_text(name, file.data, &len, &map);
+            if (pchout) {
+                /* the unit is a header prefix, nothing is parsed */
+                if (zcc_pch_emit(pchout, &map, src, &len, &defines, includes.data)) {
+                    zcc_log("zcc could not write precompiled header '%s'.\n", pchout);
+                    status = Z_EXIT_FAILURE;
+                }
+                zcc_funmap(&file);
+                continue;
+            }
+            
             if (preproc) {
-                src = zcc_preprocess_macros(src, &len, &defines, includes.data);
+                /* macro expansion writes to a new heap buffer */
+                src = zcc_preprocess_macros(&map, src, &len, &defines, includes.data);
             }
 
             if (ppprint) {
                 zcc_log("%s\n", src);
             }
 
-            ast = zparse_source(src);
+            ast = zparse_source(&map, src);
             if (ast) {
                 zparse_tree_print(ast, 0);
                 zparse_free(ast);
             }
-            zfree(src);
+            zsrcmap_free(&map);
+            if (preproc) {
+                zfree(src);
+            }
+            zcc_funmap(&file);
         }
         else zcc_log("zcc could not open translation unit '%s'.\n", filepaths[i]);
     }
 
 exit:
-    zcc_defines_free(&defines, 0);
+    zcc_defines_free(&defines);
+    zcc_pch_free();
     vector_free(&infiles);
     vector_free(&includes);
+    zheader_free();
+    zinclude_free();
+    zatom_free();
     return status;
 }
@@ -0,0 +1,127 @@
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zatom.h>
+
+#define ZATOM_BLOCK 0x10000
+
+struct zatom {
+    const char* str;
+    unsigned int len;
+    unsigned int hash;
+};
+
+/* Spellings are packed into large blocks chained through their first
+ * bytes, the open addressed slots hold atoms indexing the atom array */
+static struct zatom_table {
+    struct zatom* atoms;
+    unsigned int* slots;
+    unsigned int count;
+    unsigned int capacity;
+    unsigned int mask;
+    char* block;
+    size_t used;
+    size_t size;
+} zatoms = {NULL, NULL, 0, 0, 0, NULL, 0, 0};
+
+unsigned int zatom_hash(const char* str, const size_t len)
+{
+    size_t i;
+    unsigned int hash = 2166136261u;
+    for (i = 0; i < len; ++i) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static char* zatom_store(const char* str, const size_t len)
+{
+    char* s;
+    if (zatoms.used + len + 1 > zatoms.size) {
+        const size_t size = len + 1 > ZATOM_BLOCK ? len + 1 : ZATOM_BLOCK;
+        char* block = zmalloc(sizeof(char*) + size);
+        zmemcpy(block, &zatoms.block, sizeof(char*));
+        zatoms.block = block;
+        zatoms.used = sizeof(char*);
+        zatoms.size = sizeof(char*) + size;
+    }
+
+    s = zatoms.block + zatoms.used;
+    zmemcpy(s, str, len);
+    s[len] = 0;
+    zatoms.used += len + 1;
+    return s;
+}
+
+static void zatom_rehash(void)
+{
+    unsigned int i, j;
+    const unsigned int slots = zatoms.mask ? (zatoms.mask + 1) * 2 : 0x400;
+    zfree(zatoms.slots);
+    zatoms.slots = zmalloc(slots * sizeof(unsigned int));
+    zmemset(zatoms.slots, 0, slots * sizeof(unsigned int));
+    zatoms.mask = slots - 1;
+
+    for (i = 1; i < zatoms.count; ++i) {
+        for (j = zatoms.atoms[i].hash & zatoms.mask; zatoms.slots[j]; j = (j + 1) & zatoms.mask);
+        zatoms.slots[j] = i;
+    }
+}
+
+unsigned int zatom_intern(const char* str, const size_t len, const unsigned int hash)
+{
+    unsigned int i, atom;
+    if (2 * (zatoms.count + 1) > zatoms.mask) {
+        zatom_rehash();
+    }
+
+    for (i = hash & zatoms.mask; (atom = zatoms.slots[i]); i = (i + 1) & zatoms.mask) {
+        const struct zatom* a = zatoms.atoms + atom;
+        if (a->hash == hash && a->len == len && !zmemcmp(a->str, str, len)) {
+            return atom;
+        }
+    }
+
+    if (!zatoms.count) {
+        zatoms.count = 1;
+    }
+
+    if (zatoms.count >= zatoms.capacity) {
+        zatoms.capacity = zatoms.capacity ? zatoms.capacity * 2 : 0x200;
+        zatoms.atoms = zrealloc(zatoms.atoms, zatoms.capacity * sizeof(struct zatom));
+    }
+
+    atom = zatoms.count++;
+    zatoms.atoms[atom].str = zatom_store(str, len);
+    zatoms.atoms[atom].len = (unsigned int)len;
+    zatoms.atoms[atom].hash = hash;
+    zatoms.slots[i] = atom;
+    return atom;
+}
+
+unsigned int zatom_get(const char* str, const size_t len)
+{
+    return zatom_intern(str, len, zatom_hash(str, len));
+}
+
+const char* zatom_str(const unsigned int atom)
+{
+    return atom && atom < zatoms.count ? zatoms.atoms[atom].str : NULL;
+}
+
+size_t zatom_len(const unsigned int atom)
+{
+    return atom && atom < zatoms.count ? zatoms.atoms[atom].len : 0;
+}
+
+void zatom_free(void)
+{
+    char* next;
+    while (zatoms.block) {
+        zmemcpy(&next, zatoms.block, sizeof(char*));
+        zfree(zatoms.block);
+        zatoms.block = next;
+    }
+    zfree(zatoms.atoms);
+    zfree(zatoms.slots);
+    zmemset(&zatoms, 0, sizeof(zatoms));
+}
@@ -0,0 +1,17 @@
+#ifndef ZCC_ATOM_H
+#define ZCC_ATOM_H
+
+#include <zstddef.h>
+
+/* Process wide identifier table. Every distinct spelling is stored once,
+ * NUL terminated, and named by a 32-bit atom so identifiers compare as
+ * integers. Atom 0 is never handed out and stands for no identifier. */
+
+unsigned int zatom_hash(const char* str, const size_t len);
+unsigned int zatom_intern(const char* str, const size_t len, const unsigned int hash);
+unsigned int zatom_get(const char* str, const size_t len);
+const char* zatom_str(const unsigned int atom);
+size_t zatom_len(const unsigned int atom);
+void zatom_free(void);
+
+#endif /* ZCC_ATOM_H */
@@ -0,0 +1,146 @@
+#include <zsys.h>
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zpreprocessor.h>
+#include <zheader.h>
+
+/* Open addressed slots of header pointers, hashed on device and inode */
+static struct zheader_table {
+    struct zheader** slots;
+    unsigned int count;
+    unsigned int mask;
+} zheaders = {NULL, 0, 0};
+
+static unsigned int zheader_hash(const unsigned long dev, const unsigned long ino)
+{
+    unsigned long h = (dev * 0x9e3779b1UL) ^ ino;
+    h ^= h >> 15;
+    return (unsigned int)(h * 0x85ebca6bUL);
+}
+
+static void zheader_rehash(void)
+{
+    unsigned int i, j;
+    struct zheader** old = zheaders.slots;
+    const unsigned int oldsize = zheaders.mask ? zheaders.mask + 1 : 0;
+    const unsigned int size = oldsize ? oldsize * 2 : 0x100;
+
+    zheaders.slots = zmalloc(size * sizeof(struct zheader*));
+    zmemset(zheaders.slots, 0, size * sizeof(struct zheader*));
+    zheaders.mask = size - 1;
+
+    for (i = 0; i < oldsize; ++i) {
+        if (old[i]) {
+            j = zheader_hash(old[i]->dev, old[i]->ino) & zheaders.mask;
+            for (; zheaders.slots[j]; j = (j + 1) & zheaders.mask);
+            zheaders.slots[j] = old[i];
+        }
+    }
+    
+    if (old) {
+        zfree(old);
+    }
+}
+
+static void zheader_release(struct zheader* header)
+{
+    zcc_funmap(&header->file);
+    zsrcmap_free(&header->map);
+}
+
+/* Reads and strips the file behind fd into header */
+static void zheader_load(struct zheader* header, const int fd, const char* path)
+{
+    header->file = zcc_fdmap(fd);
+    header->len = header->file.size;
+    header->map = zsrcmap_create(path);
+    header->guard = 0;
+    header->once = 0;
+    header->unit = 0;
+    header->prefix = 0;
+    if (header->file.data) {
+        zcc_preprocess_text(path, header->file.data, &header->len, &header->map);
+        header->guard = zcc_preprocess_guard(header->file.data);
+    }
+}
+
+/* Takes over the file descriptor, which is closed before returning */
+struct zheader* zheader_open(const int fd, const char* path)
+{
+    unsigned int i;
+    struct stat st;
+    struct zheader* header;
+    if (zfstat(fd, &st)) {
+        zcc_fclose(fd);
+        return NULL;
+    }
+
+    if (2 * (zheaders.count + 1) > zheaders.mask) {
+        zheader_rehash();
+    }
+
+    i = zheader_hash((unsigned long)st.st_dev, (unsigned long)st.st_ino) & zheaders.mask;
+    for (; (header = zheaders.slots[i]); i = (i + 1) & zheaders.mask) {
+        if (header->dev == (unsigned long)st.st_dev && header->ino == (unsigned long)st.st_ino) {
+            break;
+        }
+    }
+
+    if (header) {
+        if (header->mtime == (long)st.st_mtime && header->size == (size_t)st.st_size) {
+            zcc_fclose(fd);
+            return header->file.data ? header : NULL;
+        }
+        /* changed on disk since it was cached */
+        zheader_release(header);
+    }
+    else {
+        header = zmalloc(sizeof(struct zheader));
+        header->dev = (unsigned long)st.st_dev;
+        header->ino = (unsigned long)st.st_ino;
+        zheaders.slots[i] = header;
+        ++zheaders.count;
+    }
+
+    header->mtime = (long)st.st_mtime;
+    header->size = (size_t)st.st_size;
+    zheader_load(header, fd, path);
+    zcc_fclose(fd);
+    return header->file.data ? header : NULL;
+}
+
+/* Source map for one include of a cached header, the marks left by
+ * stripping are shared by every include */
+struct zsrcmap zheader_map(const struct zheader* header, const char* name)
+{
+    size_t i;
+    struct zsrcloc loc;
+    struct zsrcmap map = zsrcmap_create(name);
+    const struct zsrcmark* marks = header->map.marks.data;
+
+    loc.name = zsrcmap_name(&map, name);
+    loc.column = 1;
+    for (i = 1; i < header->map.marks.size; ++i) {
+        loc.line = marks[i].line;
+        zsrcmap_mark(&map, marks[i].offset, loc);
+    }
+    return map;
+}
+
+void zheader_free(void)
+{
+    unsigned int i;
+    for (i = 0; zheaders.mask && i <= zheaders.mask; ++i) {
+        if (zheaders.slots[i]) {
+            zheader_release(zheaders.slots[i]);
+            zfree(zheaders.slots[i]);
+        }
+    }
+
+    if (zheaders.slots) {
+        zfree(zheaders.slots);
+    }
+    zheaders.slots = NULL;
+    zheaders.count = 0;
+    zheaders.mask = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef ZCC_HEADER_H
+#define ZCC_HEADER_H
+
+#include <zstddef.h>
+#include <zio.h>
+#include <zsource.h>
+
+/* Process wide cache of header contents. A header is read and stripped of
+ * comments and line splices once, every later include of the same file
+ * from any translation unit reuses that text. Files are told apart by
+ * device and inode, an entry is read again when its mtime or size no
+ * longer match. The map holds the line marks left by stripping. A header
+ * whose whole text sits in one #ifndef group has that macro as its guard,
+ * once is the last translation unit it was included by under #pragma once
+ * and unit the last one it was included by at all. Headers the precompiled
+ * header in use went through under #pragma once are set prefix, they are
+ * skipped in every unit. */
+
+struct zheader {
+    unsigned long dev;
+    unsigned long ino;
+    long mtime;
+    size_t size;
+    struct zbuf file;
+    size_t len;
+    struct zsrcmap map;
+    unsigned int guard;
+    unsigned int once;
+    unsigned int unit;
+    int prefix;
+};
+
+struct zheader* zheader_open(const int fd, const char* path);
+struct zsrcmap zheader_map(const struct zheader* header, const char* name);
+void zheader_free(void);
+
+#endif /* ZCC_HEADER_H */
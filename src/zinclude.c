@@ -0,0 +1,172 @@
+#include <zsys.h>
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zatom.h>
+#include <zinclude.h>
+
+struct zincdir {
+    char* path;
+    size_t len;
+    int fd;
+};
+
+/* Lookup of a name in a directory, the path is NULL when it is not there */
+struct zincfile {
+    unsigned int dir;
+    unsigned int name;
+    char* path;
+};
+
+static struct zinclude_table {
+    struct zincdir* dirs;
+    unsigned int dircount;
+    unsigned int dircapacity;
+    struct zincfile* files;
+    unsigned int count;
+    unsigned int mask;
+} zincludes = {NULL, 0, 0, NULL, 0, 0};
+
+static unsigned int zinclude_hash(const unsigned int dir, const unsigned int name)
+{
+    unsigned int h = (dir * 0x9e3779b1u) ^ name;
+    h ^= h >> 16;
+    return h * 0x85ebca6bu;
+}
+
+unsigned int zinclude_dir(const char* path, const size_t len)
+{
+    unsigned int i;
+    struct zincdir* dir;
+    for (i = 0; i < zincludes.dircount; ++i) {
+        dir = zincludes.dirs + i;
+        if (dir->len == len && !zmemcmp(dir->path, path, len)) {
+            return i;
+        }
+    }
+
+    if (zincludes.dircount == zincludes.dircapacity) {
+        zincludes.dircapacity = zincludes.dircapacity ? zincludes.dircapacity * 2 : 0x10;
+        zincludes.dirs = zrealloc(zincludes.dirs, zincludes.dircapacity * sizeof(struct zincdir));
+    }
+
+    /* a directory that cannot be opened is kept too and finds nothing */
+    dir = zincludes.dirs + zincludes.dircount;
+    dir->path = zmalloc(len + 1);
+    zmemcpy(dir->path, path, len);
+    dir->path[len] = 0;
+    dir->len = len;
+    dir->fd = zopen(dir->path, O_RDONLY | O_DIRECTORY);
+    return zincludes.dircount++;
+}
+
+static void zinclude_rehash(void)
+{
+    unsigned int i, j;
+    struct zincfile* old = zincludes.files;
+    const unsigned int oldsize = zincludes.mask ? zincludes.mask + 1 : 0;
+    const unsigned int size = oldsize ? oldsize * 2 : 0x400;
+
+    zincludes.files = zmalloc(size * sizeof(struct zincfile));
+    zmemset(zincludes.files, 0, size * sizeof(struct zincfile));
+    zincludes.mask = size - 1;
+
+    for (i = 0; i < oldsize; ++i) {
+        if (old[i].name) {
+            j = zinclude_hash(old[i].dir, old[i].name) & zincludes.mask;
+            for (; zincludes.files[j].name; j = (j + 1) & zincludes.mask);
+            zincludes.files[j] = old[i];
+        }
+    }
+
+    if (old) {
+        zfree(old);
+    }
+}
+
+/* Directory path and name joined, absolute names stand on their own */
+static char* zinclude_path(const struct zincdir* dir, const unsigned int name)
+{
+    char* path;
+    const char* str = zatom_str(name);
+    const size_t len = zatom_len(name);
+    size_t dlen = dir->len;
+
+    if (*str == '/') {
+        dlen = 0;
+    }
+
+    path = zmalloc(dlen + len + 2);
+    zmemcpy(path, dir->path, dlen);
+    if (dlen && path[dlen - 1] != '/') {
+        path[dlen++] = '/';
+    }
+    zmemcpy(path + dlen, str, len + 1);
+    return path;
+}
+
+/* Opens name in the directory, returns the file descriptor and its path
+ * or -1 when it is not found there */
+int zinclude_open(const unsigned int dir, const unsigned int name, const char** path)
+{
+    int fd;
+    unsigned int i;
+    struct zincfile* file;
+    const struct zincdir* d = zincludes.dirs + dir;
+    if (d->fd < 0) {
+        return -1;
+    }
+
+    if (2 * (zincludes.count + 1) > zincludes.mask) {
+        zinclude_rehash();
+    }
+
+    i = zinclude_hash(dir, name) & zincludes.mask;
+    for (; (file = zincludes.files + i)->name; i = (i + 1) & zincludes.mask) {
+        if (file->dir == dir && file->name == name) {
+            if (!file->path) {
+                return -1;
+            }
+            *path = file->path;
+            return zopenat(d->fd, zatom_str(name), O_RDONLY);
+        }
+    }
+
+    fd = zopenat(d->fd, zatom_str(name), O_RDONLY);
+    file->dir = dir;
+    file->name = name;
+    file->path = fd < 0 ? NULL : zinclude_path(d, name);
+    ++zincludes.count;
+    
+    *path = file->path;
+    return fd;
+}
+
+void zinclude_free(void)
+{
+    unsigned int i;
+    for (i = 0; i < zincludes.dircount; ++i) {
+        if (zincludes.dirs[i].fd >= 0) {
+            zclose(zincludes.dirs[i].fd);
+        }
+        zfree(zincludes.dirs[i].path);
+    }
+
+    for (i = 0; zincludes.mask && i <= zincludes.mask; ++i) {
+        if (zincludes.files[i].path) {
+            zfree(zincludes.files[i].path);
+        }
+    }
+
+    if (zincludes.dirs) {
+        zfree(zincludes.dirs);
+    }
+    if (zincludes.files) {
+        zfree(zincludes.files);
+    }
+    zincludes.dirs = NULL;
+    zincludes.dircount = 0;
+    zincludes.dircapacity = 0;
+    zincludes.files = NULL;
+    zincludes.count = 0;
+    zincludes.mask = 0;
+}
@@ -0,0 +1,16 @@
+#ifndef ZCC_INCLUDE_H
+#define ZCC_INCLUDE_H
+
+#include <zstddef.h>
+
+/* Include file resolution. Search directories are opened once and named
+ * by an index, files are probed relative to them with openat. Whether a
+ * name exists in a directory is remembered for the whole run, found or
+ * not, so a name is looked for at most once in each directory. Names are
+ * atoms of the spelling between the quotes or brackets. */
+
+unsigned int zinclude_dir(const char* path, const size_t len);
+int zinclude_open(const unsigned int dir, const unsigned int name, const char** path);
+void zinclude_free(void);
+
+#endif /* ZCC_INCLUDE_H */
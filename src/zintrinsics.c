@@ -1,6 +1,7 @@
 #include <zstring.h>
 #include <ztoken.h>
 #include <zintrinsics.h>
+#include <zatom.h>
 
 /* shared string buffer across zcc */
 
@@ -12,26 +13,6 @@ char* zstrbuf(const char* str, const size_t len)
     return buf;
 }
 
-/* constant reserved C keywords */
-
-struct hash zcc_keywords_std(void)
-{
-    static const char* reserved[] = {
-        "auto", "break", "case", "char", "const", "continue", "default", 
-        "do", "double", "else", "enum", "extern", "float", "for", "goto",
-        "if", "int", "long", "register", "return", "short", "signed",
-        "sizeof", "static", "struct", "switch", "typedef", "union",
-        "unsigned", "void", "volatile", "while"
-    };
-
-    size_t i;
-    struct hash keywords = hash_create(sizeof(char*));
-    for (i = 0; i < sizeof(reserved) / sizeof(reserved[0]); ++i) {
-        hash_push(&keywords, reserved + i);
-    }
-    return keywords;
-}
-
 struct vector zcc_includes_std(void)
 {
     static const char* stddirs[] = {"/usr/include/", "/usr/local/include/"
@@ -48,14 +29,10 @@ struct vector zcc_includes_std(void)
     return includes;
 }
 
-size_t zcc_map_search(const struct map* map, const struct token tok)
-{
-    const char* s = zstrbuf(tok.str, tok.len);
-    return map_search(map, &s);
-}
+/* Interned spellings are already NUL terminated, no copy is needed */
 
 size_t zcc_hash_search(const struct hash* map, const struct token tok)
 {
-    const char* s = zstrbuf(tok.str, tok.len);
+    const char* s = tok.atom ? zatom_str(tok.atom) : zstrbuf(tok.str, tok.len);
     return hash_search(map, &s);
 }
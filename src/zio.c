@@ -4,6 +4,15 @@
 #include <zstdarg.h>
 #include <zio.h>
 
+/* Files are mapped in pages of at least this size. A file whose size is
+ * not a multiple of it ends inside its last page, which the kernel pads
+ * with zeros, so the terminating NUL comes for free. */
+#define ZCC_PAGE 0x1000
+
+/* Inputs of unknown size, like pipes, are read in steps that start at
+ * this size and double */
+#define ZCC_READ 0x10000
+
 int zcc_log(const char* fmt, ...)
 {
     int ret;
@@ -14,21 +23,145 @@ int zcc_log(const char* fmt, ...)
     return ret;
 }
 
+int zcc_fopen(const char* path)
+{
+    int fd;
+    if (path[0] == '-' && !path[1]) {
+        return STDIN_FILENO;
+    }
+    fd = zopen(path, O_RDONLY);
+    return fd > STDERR_FILENO ? fd : -1;
+}
+
+void zcc_fclose(const int fd)
+{
+    if (fd > STDERR_FILENO) {
+        zclose(fd);
+    }
+}
+
+static char* zcc_fread_fd(const int fd, size_t capacity, size_t* size)
+{
+    long n;
+    size_t len = 0;
+    char* data = zmalloc(capacity + 1);
+
+    /* read until end of file, short reads and pipes just loop. The byte
+     * kept for the NUL is read into too, so a file of the expected size
+     * ends with a read of 0 instead of a reallocation. */
+    while (data) {
+        n = (long)zread(fd, data + len, capacity + 1 - len);
+        if (n <= 0) {
+            data[len] = 0;
+            break;
+        }
+
+        len += (size_t)n;
+        if (len > capacity) {
+            capacity = capacity ? capacity * 2 : ZCC_READ;
+            data = zrealloc(data, capacity + 1);
+        }
+    }
+
+    *size = len;
+    return data;
+}
+
 char* zcc_fread(const char* path, size_t* size)
 {
-    void* data = NULL;
+    char* data = NULL;
     size_t len = 0;
-    int fd = zopen(path, O_RDONLY);
-    if (fd > STDERR_FILENO) {
+    int fd = zcc_fopen(path);
+    if (fd >= 0) {
         struct stat st;
-        zfstat(fd, &st);
-        len = (size_t)st.st_size;
-        data = zmalloc(len);
-        if (len && data) {
-            zread(fd, data, len);
+        if (!zfstat(fd, &st) && S_ISREG(st.st_mode)) {
+            len = (size_t)st.st_size;
         }
-        zclose(fd);
+        data = zcc_fread_fd(fd, len, &len);
+        zcc_fclose(fd);
     }
     *size = len;
     return data;
 }
+
+struct zbuf zcc_fdmap(const int fd)
+{
+    struct stat st;
+    struct zbuf buf = {NULL, 0, 0};
+
+    /* standard input is read even when redirected from a file, it may not
+     * be at the start of it */
+    if (fd == STDIN_FILENO || zfstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        buf.data = zcc_fread_fd(fd, 0, &buf.size);
+        return buf;
+    }
+
+    /* private writable mapping, the preprocessor strips text in place and
+     * only the pages it touches get copied */
+    buf.size = (size_t)st.st_size;
+    if (buf.size % ZCC_PAGE) {
+        buf.mapsize = buf.size;
+        buf.data = zmmap(NULL, buf.mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    else {
+        /* the file fills its last page, map it over zeroed memory one
+         * page longer so the byte past the end still reads as NUL */
+        buf.mapsize = buf.size + ZCC_PAGE;
+        buf.data = zmmap(NULL, buf.mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf.data != MAP_FAILED && buf.size) {
+            if (zmmap(buf.data, buf.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                zmunmap(buf.data, buf.mapsize);
+                buf.data = MAP_FAILED;
+            }
+        }
+    }
+
+    if (buf.data == MAP_FAILED) {
+        buf.mapsize = 0;
+        buf.data = zcc_fread_fd(fd, buf.size, &buf.size);
+    }
+    return buf;
+}
+
+struct zbuf zcc_fmap(const char* path)
+{
+    struct zbuf buf = {NULL, 0, 0};
+    const int fd = zcc_fopen(path);
+    if (fd >= 0) {
+        buf = zcc_fdmap(fd);
+        zcc_fclose(fd);
+    }
+    return buf;
+}
+
+int zcc_fwrite(const char* path, const char* data, const size_t size)
+{
+    long n;
+    size_t len = 0;
+    const int fd = zopen(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return Z_EXIT_FAILURE;
+    }
+
+    while (len < size) {
+        n = (long)zwrite(fd, data + len, size - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    
+    zclose(fd);
+    return len == size ? Z_EXIT_SUCCESS : Z_EXIT_FAILURE;
+}
+
+void zcc_funmap(struct zbuf* buf)
+{
+    if (buf->mapsize) {
+        zmunmap(buf->data, buf->mapsize);
+    }
+    else zfree(buf->data);
+    buf->data = NULL;
+    buf->size = 0;
+    buf->mapsize = 0;
+}
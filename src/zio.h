@@ -3,7 +3,22 @@
 
 #include <zstddef.h>
 
+/* NUL terminated file contents. Regular files are memory mapped, anything
+ * else is read into the heap and has a mapsize of 0. A path of "-" stands
+ * for standard input. */
+struct zbuf {
+    char* data;
+    size_t size;
+    size_t mapsize;
+};
+
 int zcc_log(const char* fmt, ...);
+int zcc_fopen(const char* path);
+void zcc_fclose(const int fd);
 char* zcc_fread(const char* filename, size_t* size);
+struct zbuf zcc_fmap(const char* filename);
+struct zbuf zcc_fdmap(const int fd);
+int zcc_fwrite(const char* path, const char* data, const size_t size);
+void zcc_funmap(struct zbuf* buf);
 
 #endif /* ZCC_IO_H */
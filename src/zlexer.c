@@ -1,5 +1,8 @@
 #include <zlexer.h>
 #include <zstring.h>
+#include <zscan.h>
+#include <zatom.h>
+#include <zthread.h>
 #include <zdbg.h>
 
 /* Basic composable lexing / tokenizing functions */
@@ -12,26 +15,18 @@ char* zcc_lexnull(const char* str)
 
 char* zcc_lexnone(const char* str)
 {
-    while (*str && !_isgraph(*str)) {
-        ++str;
-    }
+    str = zscan_graph(str);
     return *str ? (char*)(size_t)str : NULL;
 }
 
 char* zcc_lexline(const char* str)
 {    
-    while (*str && *str != '\n' && *str != '\r') {
-        ++str;
-    }
-    return (char*)(size_t)str;
+    return (char*)(size_t)zscan_line(str);
 }
 
 char* zcc_lexspace(const char* str)
 {
-    while (*str && (*str == ' ' || *str == '\t')) {
-        ++str;
-    }
-
+    str = zscan_blank(str);
     if (!*str || *str == '\n' || *str == '\r') {
         return NULL;
     }
@@ -45,10 +40,12 @@ char* zcc_lexstr(const char* str)
     zassert(_isstr(*str));
     
     c = *str++;
-    while (*str && *str != c) {
-        str += (*str == '\\') + 1;
+    str = zscan_quote(str, c);
+    while (*str == '\\') {
+        str += !!str[1] + 1;
+        str = zscan_quote(str, c);
     }
-    return (char*)(size_t)++str;
+    return (char*)(size_t)str + !!*str;
 }
 
 char* zcc_lexparen(const char* str)
@@ -86,10 +83,7 @@ char* zcc_lexnum(const char* str)
 char* zcc_lexid(const char* str)
 {
     zassert(_isid(*str));
-    while (*str && (_isid(*str) || _isdigit(*str))) {
-        ++str;
-    }
-    return (char*)(size_t)str;
+    return (char*)(size_t)zscan_id(str);
 }
 
 char* zcc_lexop(const char* str)
@@ -132,63 +126,213 @@ char* zcc_lexop(const char* str)
     return (char*)(size_t)str;
 }
 
-static unsigned int zlex_type(const char* str)
-{
-    if (!str || !*str) {
-        return ZTOK_NULL;
-    }
+/* Table-driven lexer core: every byte maps to a character class and every
+ * (state, class) pair maps to the next state, so a single loop classifies
+ * and consumes a whole token. ZLEX_DONE stops before the current byte. */
 
-    if (!_isgraph(*str)) {
-        return ZTOK_NON;
-    }
+enum zlex_class {
+    ZLEX_C_NUL,
+    ZLEX_C_SPACE,
+    ZLEX_C_DQUOTE,
+    ZLEX_C_SQUOTE,
+    ZLEX_C_BSLASH,
+    ZLEX_C_DIGIT,
+    ZLEX_C_EXP,
+    ZLEX_C_ALPHA,
+    ZLEX_C_DOT,
+    ZLEX_C_PLUS,
+    ZLEX_C_MINUS,
+    ZLEX_C_LT,
+    ZLEX_C_GT,
+    ZLEX_C_AMP,
+    ZLEX_C_PIPE,
+    ZLEX_C_EQ,
+    ZLEX_C_HASH,
+    ZLEX_C_OPEQ,
+    ZLEX_C_PUNCT,
+    ZLEX_C_COUNT
+};
 
-    if (_isstr(*str)) {
-        return ZTOK_STR;
-    }
-    
-    if (_isdigit(*str) || (*str == '.' && _isdigit(str[1]))) {
-        return ZTOK_NUM;
-    }
-    
-    if (_isid(*str)) {
-        return ZTOK_ID;
-    }
-    
-    if (_ispunct(*str)) {
-        return ZTOK_SYM;
+enum zlex_state {
+    ZLEX_START,
+    ZLEX_NONE,
+    ZLEX_ID,
+    ZLEX_NUM,
+    ZLEX_NUMEXP,
+    ZLEX_DSTR,
+    ZLEX_DESC,
+    ZLEX_SSTR,
+    ZLEX_SESC,
+    ZLEX_STREND,
+    ZLEX_DOT,
+    ZLEX_DOT2,
+    ZLEX_PLUS,
+    ZLEX_MINUS,
+    ZLEX_LT,
+    ZLEX_LT2,
+    ZLEX_GT,
+    ZLEX_GT2,
+    ZLEX_AMP,
+    ZLEX_PIPE,
+    ZLEX_HASH,
+    ZLEX_OPEQ,
+    ZLEX_SYMEND,
+    ZLEX_DONE
+};
+
+#define C0 ZLEX_C_NUL
+#define CS ZLEX_C_SPACE
+#define CQ ZLEX_C_DQUOTE
+#define CC ZLEX_C_SQUOTE
+#define CB ZLEX_C_BSLASH
+#define CD ZLEX_C_DIGIT
+#define CE ZLEX_C_EXP
+#define CA ZLEX_C_ALPHA
+#define CP ZLEX_C_PUNCT
+
+static const unsigned char zlex_class[256] = {
+    C0, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, ZLEX_C_OPEQ, CQ, ZLEX_C_HASH, CP, ZLEX_C_OPEQ, ZLEX_C_AMP, CC,
+    CP, CP, ZLEX_C_OPEQ, ZLEX_C_PLUS, CP, ZLEX_C_MINUS, ZLEX_C_DOT, ZLEX_C_OPEQ,
+    CD, CD, CD, CD, CD, CD, CD, CD, CD, CD,
+    CP, CP, ZLEX_C_LT, ZLEX_C_EQ, ZLEX_C_GT, CP,
+    CP, CA, CA, CA, CA, CE, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+    CE, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CP, CB, CP, ZLEX_C_OPEQ, CA,
+    CP, CA, CA, CA, CA, CE, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA,
+    CE, CA, CA, CA, CA, CA, CA, CA, CA, CA, CA, CP, ZLEX_C_PIPE, CP, ZLEX_C_OPEQ, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS,
+    CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS, CS
+};
+
+#undef C0
+#undef CS
+#undef CQ
+#undef CC
+#undef CB
+#undef CD
+#undef CE
+#undef CA
+#undef CP
+
+#define XX ZLEX_DONE
+#define NO ZLEX_NONE
+#define ID ZLEX_ID
+#define NU ZLEX_NUM
+#define NE ZLEX_NUMEXP
+#define DS ZLEX_DSTR
+#define DE ZLEX_DESC
+#define SS ZLEX_SSTR
+#define SC ZLEX_SESC
+#define SN ZLEX_STREND
+#define D1 ZLEX_DOT
+#define D2 ZLEX_DOT2
+#define PL ZLEX_PLUS
+#define MI ZLEX_MINUS
+#define L1 ZLEX_LT
+#define L2 ZLEX_LT2
+#define G1 ZLEX_GT
+#define G2 ZLEX_GT2
+#define AM ZLEX_AMP
+#define PI ZLEX_PIPE
+#define HA ZLEX_HASH
+#define OQ ZLEX_OPEQ
+#define SE ZLEX_SYMEND
+
+static const unsigned char zlex_dfa[ZLEX_DONE][ZLEX_C_COUNT] = {
+    /*           NUL sp  "   '   \   0-9 e   a-z .   +   -   <   >   &   |   =   #   !*  punct */
+    /* START  */ {XX, NO, DS, SS, SE, NU, ID, ID, D1, PL, MI, L1, G1, AM, PI, OQ, HA, OQ, SE},
+    /* NONE   */ {XX, NO, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* ID     */ {XX, XX, XX, XX, XX, ID, ID, ID, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* NUM    */ {XX, XX, XX, XX, XX, NU, NE, NU, NU, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* NUMEXP */ {XX, XX, XX, XX, XX, NU, NE, NU, NU, NU, NU, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* DSTR   */ {XX, DS, SN, DS, DE, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS},
+    /* DESC   */ {XX, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS, DS},
+    /* SSTR   */ {XX, SS, SS, SN, SC, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS},
+    /* SESC   */ {XX, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS, SS},
+    /* STREND */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* DOT    */ {XX, XX, XX, XX, XX, NU, XX, XX, D2, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* DOT2   */ {XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX},
+    /* PLUS   */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX, XX, XX, XX, SE, XX, XX, XX},
+    /* MINUS  */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, SE, XX, XX, SE, XX, XX, XX},
+    /* LT     */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, L2, XX, XX, XX, SE, XX, XX, XX},
+    /* LT2    */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX, XX},
+    /* GT     */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, G2, XX, XX, SE, XX, XX, XX},
+    /* GT2    */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX, XX},
+    /* AMP    */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, SE, XX, XX, XX},
+    /* PIPE   */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, SE, XX, XX, XX},
+    /* HASH   */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX},
+    /* OPEQ   */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, SE, XX, XX, XX},
+    /* SYMEND */ {XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX}
+};
+
+#undef XX
+#undef NO
+#undef ID
+#undef NU
+#undef NE
+#undef DS
+#undef DE
+#undef SS
+#undef SC
+#undef SN
+#undef D1
+#undef D2
+#undef PL
+#undef MI
+#undef L1
+#undef L2
+#undef G1
+#undef G2
+#undef AM
+#undef PI
+#undef HA
+#undef OQ
+#undef SE
+
+static const unsigned char zlex_types[ZLEX_DONE] = {
+    ZTOK_NULL, ZTOK_NON, ZTOK_ID, ZTOK_NUM, ZTOK_NUM,
+    ZTOK_STR, ZTOK_STR, ZTOK_STR, ZTOK_STR, ZTOK_STR,
+    ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM,
+    ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM, ZTOK_SYM
+};
+
+static char* zlex_scan(const char* str, unsigned int* typeptr)
+{
+    unsigned int state = ZLEX_START, next;
+    while ((next = zlex_dfa[state][zlex_class[(unsigned char)*str]]) != ZLEX_DONE) {
+        state = next;
+        ++str;
     }
     
-    return ZTOK_NULL;
+    /* ".." is two separate dots, give back the second one */
+    str -= (state == ZLEX_DOT2);
+    *typeptr = zlex_types[state];
+    return (char*)(size_t)str;
 }
 
 /* Main generic tokenization function */
 
 char* zlex_next(const char* str, unsigned int* typeptr)
 {
-    static char* (*zlex_funcs[])(const char*) = {
-        &zcc_lexnull,
-        &zcc_lexid,
-        &zcc_lexnum,
-        &zcc_lexop,
-        &zcc_lexstr,
-        &zcc_lexnone
-    };
-    
-    *typeptr = zlex_type(str);
-    return zlex_funcs[*typeptr](str);
+    char* end;
+    if (!str) {
+        *typeptr = ZTOK_NULL;
+        return NULL;
+    }
+
+    end = zlex_scan(str, typeptr);
+    return *typeptr != ZTOK_NULL ? end : NULL;
 }
 
 char* zcc_lex(const char* str, unsigned int* len, unsigned int* typeptr)
 {
-    static char* (*zlex_funcs[5])(const char*) = {
-        &zcc_lexnull,
-        &zcc_lexid,
-        &zcc_lexnum,
-        &zcc_lexop,
-        &zcc_lexstr
-    };
-
-
     const char* c;
     if (str) {
         str = zcc_lexspace(str);
@@ -199,8 +343,7 @@ char* zcc_lex(const char* str, unsigned int* len, unsigned int* typeptr)
     }
 
     c = str;
-    *typeptr = zlex_type(str);
-    str = zlex_funcs[*typeptr](str);
+    str = zlex_scan(str, typeptr);
     *len = str - c;
     
     return (char*)(size_t)c;
@@ -208,23 +351,31 @@ char* zcc_lex(const char* str, unsigned int* len, unsigned int* typeptr)
 
 /* Handy struct to handle tokens */
 
-struct token ztok_get(const char* str)
+static struct token ztok_lex(const char* str)
 {
     struct token tok;
-    tok.str = zcc_lex(str, &tok.len, &tok.type);
+    unsigned int type = ZTOK_NULL;
+    tok.len = 0;
+    tok.str = zcc_lex(str, &tok.len, &type);
+    tok.type = type;
+    tok.kind = tok.str ? zkind_classify(tok.str, tok.len, type) : ZKIND_NULL;
+    tok.atom = tok.str && type == ZTOK_ID ? zatom_get(tok.str, tok.len) : 0;
     return tok;
 }
 
+struct token ztok_get(const char* str)
+{
+    return ztok_lex(str);
+}
+
 struct token ztok_next(struct token tok)
 {
-    tok.str = zcc_lex(tok.str + tok.len + (tok.str[tok.len] == '\n'), &tok.len, &tok.type);
-    return tok;
+    return ztok_lex(tok.str + tok.len + (tok.str[tok.len] == '\n'));
 }
 
 struct token ztok_nextl(struct token tok)
 {
-    tok.str = zcc_lex(tok.str + tok.len, &tok.len, &tok.type);
-    return tok;
+    return ztok_lex(tok.str + tok.len);
 }
 
 /* Tokenize strings and ranges of strings */
@@ -241,6 +392,174 @@ struct vector zcc_tokenize(const char* str)
     return tokens;
 }
 
+/* Tokenizes a whole text across lines into a token array that ends with a
+ * ZTOK_NULL token pointing at the terminating NUL, ready for the parser. */
+
+struct tokarray zcc_tokenize_text(const char* str)
+{
+    char* end;
+    unsigned int type;
+    struct token tok;
+    struct tokarray tokens = ztoks_create(str);
+    
+    while ((end = zlex_next(str, &type))) {
+        if (type != ZTOK_NON) {
+            tok = ztokget(str, end, type);
+            ztoks_push(&tokens, &tok);
+        }
+        str = end;
+    }
+    
+    tok = ztokget(str, str, ZTOK_NULL);
+    ztoks_push(&tokens, &tok);
+    return tokens;
+}
+
+/* Parallel tokenization of one large text. The text is cut at newlines
+ * into a chunk per thread and each chunk is lexed on its own, then joined
+ * into the array zcc_tokenize_text would give. Block comments are still
+ * plain text to the lexer, so only string and character literals carry
+ * its state across a newline. A sequential pass tracks them and moves
+ * every cut to a newline outside of any literal, so no chunk starts in
+ * the middle of a token. Identifiers are interned after the join since
+ * the atom table is not shared between threads. */
+
+#ifndef ZLEX_CHUNK_MIN
+#define ZLEX_CHUNK_MIN 0x40000
+#endif
+
+int zcc_lexthreads = 1;
+
+struct zlex_chunk {
+    const char* begin;
+    const char* end;
+    struct tokarray toks;
+};
+
+/* Returns the first newline at or past cut that is outside of literals,
+ * str must be outside of them too. Like the lexer any quote opens one and
+ * a backslash inside escapes the next byte. */
+static const char* zlex_cut(const char* str, const char* cut, const char* end)
+{
+    char quote = 0;
+    for (; str < end; ++str) {
+        if (quote) {
+            if (*str == '\\') {
+                if (++str == end) {
+                    break;
+                }
+            }
+            else if (*str == quote) {
+                quote = 0;
+            }
+        }
+        else if (*str == '"' || *str == '\'') {
+            quote = *str;
+        }
+        else if (*str == '\n' && str >= cut) {
+            return str;
+        }
+    }
+    return end;
+}
+
+static void zlex_chunk_run(void* arg)
+{
+    int grow;
+    char* end;
+    unsigned int type;
+    struct token tok;
+    struct zlex_chunk* chunk = arg;
+    struct tokarray* toks = &chunk->toks;
+    const char* str = chunk->begin;
+
+    while (str < chunk->end && (end = zlex_next(str, &type))) {
+        if (type != ZTOK_NON) {
+            tok.str = str;
+            tok.len = end - str;
+            tok.type = type;
+            tok.kind = zkind_classify(str, tok.len, type);
+            /* hashed here, interned after the join */
+            tok.atom = type == ZTOK_ID ? zatom_hash(str, tok.len) : 0;
+
+            /* the allocator is not shared either */
+            grow = toks->size == toks->capacity || 
+                ((tok.kind == ZKIND_NUM || tok.kind == ZKIND_CHR) && toks->litsize == toks->litcapacity);
+            if (grow) {
+                zthread_lock();
+            }
+            ztoks_push(toks, &tok);
+            if (grow) {
+                zthread_unlock();
+            }
+        }
+        str = end;
+    }
+}
+
+struct tokarray zcc_tokenize_parallel(const char* str, unsigned int threads)
+{
+    unsigned int i, n;
+    struct token tok;
+    struct tokarray tokens;
+    struct zlex_chunk* chunks;
+    void** args;
+    const size_t size = zstrlen(str);
+    const char* cut = str, *end = str + size;
+
+    if (threads > size / ZLEX_CHUNK_MIN) {
+        threads = (unsigned int)(size / ZLEX_CHUNK_MIN);
+    }
+    if (threads < 2) {
+        return zcc_tokenize_text(str);
+    }
+
+    chunks = zmalloc(threads * sizeof(struct zlex_chunk));
+    args = zmalloc(threads * sizeof(void*));
+    for (n = 0; n < threads && cut < end; ++n) {
+        chunks[n].begin = cut;
+        cut = n + 1 < threads ? zlex_cut(cut, str + size / threads * (n + 1), end) : end;
+        chunks[n].end = cut;
+        /* about one token every four bytes and a literal every 32 */
+        chunks[n].toks = ztoks_create(str);
+        ztoks_reserve(&chunks[n].toks, (cut - chunks[n].begin) / 4 + 1, (cut - chunks[n].begin) / 32 + 1);
+        args[n] = chunks + n;
+    }
+    
+    zthread_run(&zlex_chunk_run, args, n);
+
+    tokens = chunks[0].toks;
+    for (i = 1; i < n; ++i) {
+        ztoks_append(&tokens, &chunks[i].toks);
+        ztoks_free(&chunks[i].toks);
+    }
+    
+    for (i = 0; i < tokens.size; ++i) {
+        if (zkind_type(tokens.kinds[i]) == ZTOK_ID) {
+            tok = ztoks_at(&tokens, i);
+            tokens.atoms[i] = zatom_intern(tok.str, tok.len, tokens.atoms[i]);
+        }
+    }
+
+    tok = ztokget(end, end, ZTOK_NULL);
+    ztoks_push(&tokens, &tok);
+    zfree(chunks);
+    zfree(args);
+    return tokens;
+}
+
+struct vector zcc_tokarray_vector(const struct tokarray* toks)
+{
+    unsigned int i;
+    struct token tok;
+    struct vector tokens = vector_create(sizeof(struct token));
+    for (i = 0; i < toks->size; ++i) {
+        tok = ztoks_at(toks, i);
+        vector_push(&tokens, &tok);
+    }
+    return tokens;
+}
+
 struct vector zcc_tokenize_line(const char* str)
 {
     struct token tok;
@@ -29,6 +29,9 @@ struct token ztok_step(struct token tok, size_t steps);
 struct token ztok_stepl(struct token tok, size_t steps);
 
 struct vector zcc_tokenize(const char* str);
+struct tokarray zcc_tokenize_text(const char* str);
+struct tokarray zcc_tokenize_parallel(const char* str, unsigned int threads);
+struct vector zcc_tokarray_vector(const struct tokarray* toks);
 struct vector zcc_tokenize_line(const char* str);
 struct vector zcc_tokenize_range(const char* start, const char* end);
 
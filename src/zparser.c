@@ -4,83 +4,104 @@
 #include <zlexer.h>
 #include <ztoken.h>
 #include <zsolver.h>
+#include <zsource.h>
+#include <zatom.h>
 #include <zio.h>
 
-typedef struct treenode* (*parser_f)(const char*, char**);
+extern int zcc_lexthreads;
 
-static struct treenode* zparse_object(const char* str, char** end);
-static struct treenode* zparse_operator_postfix(const char* str, char** end);
-static struct treenode* zparse_operator_access(const char* str, char** end);
-static struct treenode* zparse_term(const char* str, char** end);
-static struct treenode* zparse_paren(const char* str, char** end, parser_f parser);
-static struct treenode* zparse_any(const char* str, char** end, parser_f parser, struct treenode* node);
-static struct treenode* zparse_enum(const char* str, char** end, parser_f parser, const char c, struct treenode* node);
+typedef struct treenode* (*parser_f)(size_t, size_t*);
 
-static int zparse_check(const char* str, char** end, const char c)
+/* Token array being parsed, terminated by a ZTOK_NULL token. Parsers take
+ * the index of their first token and write the index past their last one.
+ * Kinds and atoms are read straight from the compact buffer, full tokens
+ * are only decoded when a tree node is created. */
+static const struct tokarray* ztoks;
+
+#define zparse_at(i) ztoks_at(ztoks, (unsigned int)(i))
+#define zparse_kindat(i) ztoks->kinds[i]
+#define zparse_atomat(i) ztoks->atoms[i]
+
+/* Errors are reported at the source location of a token, resolved from
+ * its offset only once a message is printed. The map is the one left by
+ * the preprocessor, text given without one has a map of its own. */
+static struct zsrcmap* zparse_map = NULL;
+
+static void zparse_log_at(size_t cur)
+{
+    zsrcloc_log(zsrcmap_locate(zparse_map, ztoks->src, ztoks->offsets[cur]));
+}
+
+static struct treenode* zparse_node(size_t cur)
+{
+    struct token tok = zparse_at(cur);
+    return treenode_create(&tok, sizeof(struct token));
+}
+
+static struct treenode* zparse_object(size_t cur, size_t* end);
+static struct treenode* zparse_operator_postfix(size_t cur, size_t* end);
+static struct treenode* zparse_operator_access(size_t cur, size_t* end);
+static struct treenode* zparse_term(size_t cur, size_t* end);
+static struct treenode* zparse_paren(size_t cur, size_t* end, parser_f parser);
+static struct treenode* zparse_any(size_t cur, size_t* end, parser_f parser, struct treenode* node);
+static struct treenode* zparse_enum(size_t cur, size_t* end, parser_f parser, const unsigned int kind, struct treenode* node);
+
+static int zparse_check(size_t cur, size_t* end, const unsigned int kind)
 {
-    struct token tok = ztoknext(str);
-    if (tok.type != ZTOK_NULL && tok.len == 1 && tok.str[0] == c) {
-        *end = tokend(tok);
+    if (zparse_kindat(cur) == kind) {
+        *end = cur + 1;
         return 1;
     }
     return 0;
 }
 
-static struct treenode* zparse_char(const char* str, char** end, const char c)
+static struct treenode* zparse_kind(size_t cur, size_t* end, const unsigned int kind)
 {
-    struct token tok = ztoknext(str);
-    if (tok.type != ZTOK_NULL && tok.len == 1 && tok.str[0] == c) {
-        *end = tokend(tok);
-        return treenode_create(&tok, sizeof(struct token));
+    if (zparse_kindat(cur) == kind) {
+        *end = cur + 1;
+        return zparse_node(cur);
     }
     return NULL;
 }
 
-static struct treenode* zparse_token(const char* str, char** end, const char* symbol)
+static struct treenode* zparse_atom(size_t cur, size_t* end, const unsigned int atom)
 {
-    size_t len;
-    struct token tok = ztoknext(str);
-    len = zstrlen(symbol);
-    if (tok.type != ZTOK_NULL && len == tok.len && !zmemcmp(tok.str, symbol, len)) {
-        *end = tokend(tok);
-        return treenode_create(&tok, sizeof(struct token));
+    if (zparse_atomat(cur) == atom) {
+        *end = cur + 1;
+        return zparse_node(cur);
     }
     return NULL;
 }
 
-static struct treenode* zparse_identifier(const char* str, char** end)
+static struct treenode* zparse_identifier(size_t cur, size_t* end)
 {
-    struct token tok = ztoknext(str);
-    if (tok.type == ZTOK_ID) {
-        *end = tokend(tok);
-        return treenode_create(&tok, sizeof(struct token));
+    if (zparse_kindat(cur) == ZKIND_ID) {
+        *end = cur + 1;
+        return zparse_node(cur);
     }
     return NULL;
 }
 
-static struct treenode* zparse_operand(const char* str, char** end)
+static struct treenode* zparse_operand(size_t cur, size_t* end)
 {
-    struct token tok = ztoknext(str);
-    if (tok.type == ZTOK_NUM) {
-        *end = tokend(tok);
+    struct token tok = zparse_at(cur);
+    if (tok.kind == ZKIND_NUM || tok.kind == ZKIND_CHR) {
+        /* literals carry the value decoded by the lexer */
+        *end = cur + 1;
+        tok = ztoklit(&tok, ztoks_lit(ztoks, cur));
         return treenode_create(&tok, sizeof(struct token));
     }
     else if (tok.type == ZTOK_STR) {
-        struct treenode* strnode = treenode_create(&tok, sizeof(struct token));
-        *end = tokend(tok);
-        if (tok.type == ZTOK_STR && tok.str[0] == '"') {
-            tok = ztoknext(*end);
-            while (tok.type == ZTOK_STR && tok.str[0] == '"') {
-                struct token* t = strnode->data;
-                *t = ztokappend(t, &tok);
-                *end = tokend(tok);
-                tok = ztoknext(*end);
-            }
+        /* the whole run of adjacent literals becomes one token */
+        *end = cur + 1;
+        while (zparse_kindat(*end) == ZKIND_STR) {
+            ++*end;
         }
-        return strnode;
+        tok = ztoks_strcat(ztoks, cur, *end);
+        return treenode_create(&tok, sizeof(struct token));
     } else if (tok.type == ZTOK_ID) {
         struct treenode* identifier, *postfix;
-        *end = tokend(tok);
+        *end = cur + 1;
         identifier = treenode_create(&tok, sizeof(struct token));
         zparse_any(*end, end, &zparse_operator_access, identifier);
         postfix = zparse_operator_postfix(*end, end);
@@ -92,14 +113,15 @@ static struct treenode* zparse_operand(const char* str, char** end)
     return NULL;
 }
 
-static struct treenode* zparse_sizeof(const char* str, char** end)
+static struct treenode* zparse_sizeof(size_t cur, size_t* end)
 {
-    struct treenode* sizeofnode = zparse_token(str, end, "sizeof");
+    struct treenode* sizeofnode = zparse_kind(cur, end, ZKIND_SIZEOF);
     if (sizeofnode) {
         struct treenode* expr = zparse_paren(*end, end, &zparse_object);
         if (!expr) {
             expr = zparse_term(*end, end);
             if (!expr) {
+                zparse_log_at(*end);
                 zcc_log("Illegal sizeof operand.\n");
                 zparse_free(sizeofnode);
                 return NULL;
@@ -110,58 +132,52 @@ static struct treenode* zparse_sizeof(const char* str, char** end)
     return sizeofnode;
 }
 
-static struct treenode* zparse_operator_unary(const char* str, char** end)
+static struct treenode* zparse_operator_unary(size_t cur, size_t* end)
 {
-    char c;
-    struct token tok = ztoknext(str);
-
-    c = tok.str[0];
-    if (c != '+' && c != '-' && c != '~' && c != '!' && c != '&' && c != '*') {
-        return NULL;
+    switch (zparse_kindat(cur)) {
+        case ZKIND_PLUS: case ZKIND_MINUS: case ZKIND_INC: case ZKIND_DEC:
+        case ZKIND_TILDE: case ZKIND_NOT: case ZKIND_AMP: case ZKIND_STAR:
+            *end = cur + 1;
+            return zparse_node(cur);
     }
-
-    *end = tokend(tok);
-    return treenode_create(&tok, sizeof(struct token));
+    return NULL;
 }
 
-static struct treenode* zparse_operator_binary(const char* str, char** end)
+static struct treenode* zparse_operator_binary(size_t cur, size_t* end)
 {
-    static const char* nonbinary = "]}),;:?~\\@#$`'\"";
-
-    int i;
-    char c;
-    struct token tok = ztoknext(str);
-    
-    if (tok.type != ZTOK_SYM) {
+    if (zkind_type(zparse_kindat(cur)) != ZTOK_SYM) {
         return NULL;
     }
 
-    c = *tok.str;
-    for (i = 0; nonbinary[i]; ++i) {
-        if (c == nonbinary[i]) {
-            return NULL; 
-        }
+    switch (zparse_kindat(cur)) {
+        case ZKIND_RBRACKET: case ZKIND_RBRACE: case ZKIND_RPAREN:
+        case ZKIND_COMMA: case ZKIND_SEMICOLON: case ZKIND_COLON:
+        case ZKIND_QUESTION: case ZKIND_TILDE: case ZKIND_HASH:
+        case ZKIND_HASHHASH: case ZKIND_SYM:
+            return NULL;
     }
     
-    *end = tokend(tok);
-    return treenode_create(&tok, sizeof(struct token));
+    *end = cur + 1;
+    return zparse_node(cur);
 }
 
-static struct treenode* zparse_expr(const char* str, char** end);
+static struct treenode* zparse_expr(size_t cur, size_t* end);
 
-static struct treenode* zparse_operator_ternary(const char* str, char** end)
+static struct treenode* zparse_operator_ternary(size_t cur, size_t* end)
 {
-    struct treenode* operator = zparse_char(str, end, '?');
+    struct treenode* operator = zparse_kind(cur, end, ZKIND_QUESTION);
     if (operator) {
         struct treenode* expr = zparse_expr(*end, end);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected expression after '?' ternary operator.\n");
             zparse_free(operator);
             return NULL;
         }
         treenode_push(operator, expr);
 
-        if (!zparse_check(*end, end, ':')) {
+        if (!zparse_check(*end, end, ZKIND_COLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected ':' after first ternary expression.\n");
             zparse_free(operator);
             return NULL;
@@ -169,6 +185,7 @@ static struct treenode* zparse_operator_ternary(const char* str, char** end)
 
         expr = zparse_expr(*end, end);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected expression after ':' ternary operator.\n");
             zparse_free(operator);
             return NULL;
@@ -178,13 +195,14 @@ static struct treenode* zparse_operator_ternary(const char* str, char** end)
     return operator;
 }
 
-static struct treenode* zparse_funcall(const char* str, char** end)
+static struct treenode* zparse_funcall(size_t cur, size_t* end)
 {
     struct treenode* args, *check;
     struct token tok = ztokstr("()");
     args = treenode_create(&tok, sizeof(struct token));
-    check = zparse_enum(str, end, &zparse_expr, ',', args);
-    if (!zparse_check(check ? *end : str, end, ')')) {
+    check = zparse_enum(cur, end, &zparse_expr, ZKIND_COMMA, args);
+    if (!zparse_check(check ? *end : cur, end, ZKIND_RPAREN)) {
+        zparse_log_at(*end);
         zcc_log("Expected closing parenthesis after function call.\n");
         zparse_free(args);
         args = NULL;
@@ -192,40 +210,42 @@ static struct treenode* zparse_funcall(const char* str, char** end)
     return args;
 }
 
-static struct treenode* zparse_operator_access(const char* str, char** end)
+static struct treenode* zparse_operator_access(size_t cur, size_t* end)
 {
-    char c;
     struct treenode* node;
-    struct token tok = ztoknext(str);
+    struct token tok = zparse_at(cur);
 
-    c = tok.str[0];
-    if (c == '(') {
-        *end = tokend(tok);
+    if (tok.kind == ZKIND_LPAREN) {
+        *end = cur + 1;
         node = zparse_funcall(*end, end);
         if (!node) {
+            zparse_log_at(*end);
             zcc_log("Expected function call.\n");
         }
         return node;
-    } else if (c == '[') {
-        *end = tokend(tok);
+    } else if (tok.kind == ZKIND_LBRACKET) {
+        *end = cur + 1;
         node = zparse_expr(*end, end);
         if (!node) {
+            zparse_log_at(*end);
             zcc_log("Expected expression inside [] array accessor.\n");
             zparse_free(node);
             return NULL;
         }
-        if (!zparse_check(*end, end, ']')) {
+        if (!zparse_check(*end, end, ZKIND_RBRACKET)) {
+            zparse_log_at(*end);
             zcc_log("Expected closing ] parenthesis in array accessor.\n");
             zparse_free(node);
             return NULL;
         }
         return node;
-    } else if (c == '.' || (c == '-' && tok.str[1] == '>')) {
+    } else if (tok.kind == ZKIND_DOT || tok.kind == ZKIND_ARROW) {
         struct treenode* identifier;
-        *end = tokend(tok);
+        *end = cur + 1;
         node = treenode_create(&tok, sizeof(struct token));
         identifier = zparse_identifier(*end, end);
         if (!identifier) {
+            zparse_log_at(*end);
             zcc_log("Expected identifier after %s operator.\n", ztokbuf(&tok));
             zparse_free(node);
             return NULL;
@@ -239,26 +259,27 @@ static struct treenode* zparse_operator_access(const char* str, char** end)
     return treenode_create(&tok, sizeof(struct token));
 }
 
-static struct treenode* zparse_operator_postfix(const char* str, char** end)
+static struct treenode* zparse_operator_postfix(size_t cur, size_t* end)
 {
     char c;
-    struct token tok = ztoknext(str);
+    struct token tok = zparse_at(cur);
 
     c = tok.str[0];
     if ((c != '-' || tok.str[1] != '-') || (c != '+' || tok.str[1] != '+')) {
         return NULL;
     }
 
-    *end = tokend(tok);
+    *end = cur + 1;
     return treenode_create(&tok, sizeof(struct token));
 }
 
-static struct treenode* zparse_term(const char* str, char** end)
+static struct treenode* zparse_term(size_t cur, size_t* end)
 {
-    struct treenode *term = zparse_operator_unary(str, end);
+    struct treenode *term = zparse_operator_unary(cur, end);
     if (term) {
         struct treenode* realterm = zparse_term(*end, end);
         if (!realterm) {
+            zparse_log_at(*end);
             zcc_log("Expected term after unary operator %s in expression.\n", ztokbuf(term->data));
             zparse_free(term);
             return NULL;
@@ -267,11 +288,12 @@ static struct treenode* zparse_term(const char* str, char** end)
         return term;
     }
 
-    if (zparse_check(str, end, '(')) {
-        term = zparse_paren(str, end, &zparse_object);
+    if (zparse_check(cur, end, ZKIND_LPAREN)) {
+        term = zparse_paren(cur, end, &zparse_object);
         if (term) {
             struct treenode* realterm = zparse_term(*end, end);
             if (!realterm) {
+                zparse_log_at(*end);
                 zcc_log("Expected term after type cast operator %s in expression.\n", ztokbuf(term->data));
                 zparse_free(term);
                 return NULL;
@@ -280,26 +302,26 @@ static struct treenode* zparse_term(const char* str, char** end)
             return term;
         }
 
-        term = zparse_paren(str, end, &zparse_expr);
+        term = zparse_paren(cur, end, &zparse_expr);
         return term;
     }
 
-    term = zparse_sizeof(str, end);
+    term = zparse_sizeof(cur, end);
     if (term) {
         return term;
     }
 
-    return zparse_operand(str, end);
+    return zparse_operand(cur, end);
 }
 
-static struct treenode* zparse_expr_rhs(const char* str, char** end, struct treenode* lhs, int min_precedence)
+static struct treenode* zparse_expr_rhs(size_t cur, size_t* end, struct treenode* lhs, int min_precedence)
 {
     struct treenode* rhs, *op;
     struct token lookahead;
     int next_precedence, precedence;
 
-    lookahead = ztoknext(str);
-    if (lookahead.str[0] == '?') {
+    lookahead = zparse_at(cur);
+    if (lookahead.kind == ZKIND_QUESTION) {
         op = zparse_operator_ternary(*end, end);
         if (!op) {
             return NULL;
@@ -323,11 +345,11 @@ static struct treenode* zparse_expr_rhs(const char* str, char** end, struct tree
             break;
         }
         
-        lookahead = ztoknext(*end);
+        lookahead = zparse_at(*end);
         next_precedence = zsolve_precedence(lookahead.str);
 
-        if (lookahead.str[0] == '?') {
-            op = zparse_operator_ternary(lookahead.str, end);
+        if (lookahead.kind == ZKIND_QUESTION) {
+            op = zparse_operator_ternary(*end, end);
             if (!op) {
                 break;
             }
@@ -338,7 +360,7 @@ static struct treenode* zparse_expr_rhs(const char* str, char** end, struct tree
 
         while (next_precedence != -1 && next_precedence < precedence) {
             rhs = zparse_expr_rhs(*end, end, rhs, precedence - 1);
-            lookahead = ztoknext(*end);
+            lookahead = zparse_at(*end);
             next_precedence = zsolve_precedence(lookahead.str);
         }
         
@@ -352,23 +374,21 @@ static struct treenode* zparse_expr_rhs(const char* str, char** end, struct tree
     return lhs;
 }
 
-static struct treenode* zparse_expr(const char* str, char** end)
+static struct treenode* zparse_expr(size_t cur, size_t* end)
 {
-    struct treenode* lhs = zparse_term(str, end);
+    struct treenode* lhs = zparse_term(cur, end);
     return lhs ? zparse_expr_rhs(*end, end, lhs, 20) : NULL;
 }
 
-static struct treenode* zparse_constexpr(const char* str, char** end)
+static struct treenode* zparse_constexpr(size_t cur, size_t* end)
 {
-    struct treenode* expr = zparse_expr(str, end);
+    struct treenode* expr = zparse_expr(cur, end);
     if (expr) {
         struct token* tok;
         zparse_reduce(expr);
         tok = expr->data;
-        if (tok->type != ZTOK_DEF && tok->type != ZTOK_NUM && tok->str[0] != '\'') {
-            static const char sizeofstr[] = "sizeof";
-            if ((tok->len == sizeof(sizeofstr) - 1 && !zmemcmp(tok->str, sizeofstr, sizeof(sizeofstr) - 1)) || 
-                (tok->str[0] == '&' && tok->len == 1)) {
+        if (tok->kind != ZKIND_NUM && tok->kind != ZKIND_CHR) {
+            if (tok->kind == ZKIND_SIZEOF || tok->kind == ZKIND_AMP) {
                 return expr;
             }
             zparse_free(expr);
@@ -380,23 +400,24 @@ static struct treenode* zparse_constexpr(const char* str, char** end)
 
 /* COMPOSERS */
 
-static struct treenode* zparse_keywords(const char* str, char** end, const char** keywords)
+static struct treenode* zparse_keywords(size_t cur, size_t* end, const unsigned char* kinds)
 {
     int i;
-    for (i = 0; keywords[i]; ++i) {
-        struct treenode* node = zparse_token(str, end, keywords[i]);
-        if (node) {
-            return node;
+    const unsigned int kind = zparse_kindat(cur);
+    for (i = 0; kinds[i]; ++i) {
+        if (kinds[i] == kind) {
+            *end = cur + 1;
+            return zparse_node(cur);
         }
     }
     return NULL;
 }
 
-static struct treenode* zparse_or(const char* str, char** end, const parser_f* parsers)
+static struct treenode* zparse_or(size_t cur, size_t* end, const parser_f* parsers)
 {
     int i;
     for (i = 0; parsers[i]; ++i) {
-        struct treenode* node = parsers[i](str, end);
+        struct treenode* node = parsers[i](cur, end);
         if (node) {
             return node;
         }
@@ -404,9 +425,9 @@ static struct treenode* zparse_or(const char* str, char** end, const parser_f* p
     return NULL;
 }
 
-static struct treenode* zparse_any(const char* str, char** end, parser_f parser, struct treenode* root)
+static struct treenode* zparse_any(size_t cur, size_t* end, parser_f parser, struct treenode* root)
 {
-    struct treenode* node = parser(str, end);
+    struct treenode* node = parser(cur, end);
     while (node) {
         treenode_push(root, node);
         node = parser(*end, end);
@@ -414,13 +435,13 @@ static struct treenode* zparse_any(const char* str, char** end, parser_f parser,
     return root;
 }
 
-static struct treenode** zparse_chain(const char* str, char** end, const parser_f* parsers)
+static struct treenode** zparse_chain(size_t cur, size_t* end, const parser_f* parsers)
 {
     int i;
     struct treenode* node;
     struct vector chain = vector_create(sizeof(struct treenode*));
     
-    *end = (char*)(size_t)str;
+    *end = cur;
     for (i = 0; parsers[i]; ++i) {
         node = parsers[i](*end, end);
         if (node) {
@@ -436,30 +457,31 @@ static struct treenode** zparse_chain(const char* str, char** end, const parser_
     return chain.data;
 }
 
-static struct treenode* zparse_enum(const char* str, char** end, parser_f parser, const char c, struct treenode* node)
+static struct treenode* zparse_enum(size_t cur, size_t* end, parser_f parser, const unsigned int kind, struct treenode* node)
 {
-    struct treenode* child = parser(str, end);
+    struct treenode* child = parser(cur, end);
     if (child) {
         treenode_push(node, child);
-        if (!zparse_check(*end, end, c)) {
+        if (!zparse_check(*end, end, kind)) {
             return node;
         }
-        return zparse_enum(*end, end, parser, c, node);
+        return zparse_enum(*end, end, parser, kind, node);
     }
     return NULL;  
 }
 
-static struct treenode* zparse_paren(const char* str, char** end, parser_f parser)
+static struct treenode* zparse_paren(size_t cur, size_t* end, parser_f parser)
 {
-    char* mark = *end;
-    if (zparse_check(str, end, '(')) {
+    size_t mark = *end;
+    if (zparse_check(cur, end, ZKIND_LPAREN)) {
         struct treenode* node = parser(*end, end);
         if (!node) {
             *end = mark;
             return NULL;
         }
         
-        if (!zparse_check(*end, end, ')')) {
+        if (!zparse_check(*end, end, ZKIND_RPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Expected closing parenthesis.\n");
             zparse_free(node);
             *end = mark;
@@ -473,54 +495,67 @@ static struct treenode* zparse_paren(const char* str, char** end, parser_f parse
 
 /* C-Parser */
 
-static struct treenode* zparse_storage(const char* str, char** end)
+static struct treenode* zparse_storage(size_t cur, size_t* end)
 {
-    static const char* keywords[] = {"static", "extern", "register", "typedef", NULL};
-    return zparse_keywords(str, end, keywords);
+    static const unsigned char kinds[] = {ZKIND_STATIC, ZKIND_EXTERN, ZKIND_REGISTER, ZKIND_TYPEDEF, ZKIND_NULL};
+    return zparse_keywords(cur, end, kinds);
 }
 
-static struct treenode* zparse_qualifier(const char* str, char** end)
+static struct treenode* zparse_qualifier(size_t cur, size_t* end)
 {
-    static const char* keywords[] = {"const", "volatile", NULL};
-    return zparse_keywords(str, end, keywords);
+    static const unsigned char kinds[] = {ZKIND_CONST, ZKIND_VOLATILE, ZKIND_NULL};
+    return zparse_keywords(cur, end, kinds);
 }
 
-static struct treenode* zparse_signedness(const char* str, char** end)
+static struct treenode* zparse_signedness(size_t cur, size_t* end)
 {
-    static const char* keywords[] = {"signed", "unsigned", NULL};
-    return zparse_keywords(str, end, keywords);
+    static const unsigned char kinds[] = {ZKIND_SIGNED, ZKIND_UNSIGNED, ZKIND_NULL};
+    return zparse_keywords(cur, end, kinds);
 }
 
-static struct treenode* zparse_sizeness(const char* str, char** end)
+static struct treenode* zparse_sizeness(size_t cur, size_t* end)
 {
-    static const char* keywords[] = {"short", "long", NULL};
-    return zparse_keywords(str, end, keywords);
+    static const unsigned char kinds[] = {ZKIND_SHORT, ZKIND_LONG, ZKIND_NULL};
+    return zparse_keywords(cur, end, kinds);
 }
 
-static struct treenode* zparse_type(const char* str, char** end)
+static struct treenode* zparse_type(size_t cur, size_t* end)
 {
-    static const char* keywords[] = {"char", "int", "float", "double", "void", "size_t", "parser_f", NULL};
-    return zparse_keywords(str, end, keywords);
+    static const unsigned char kinds[] = {ZKIND_CHAR, ZKIND_INT, ZKIND_FLOAT, ZKIND_DOUBLE, ZKIND_VOID, ZKIND_NULL};
+    static const char* typenames[] = {"size_t", "parser_f", NULL};
+    static unsigned int atoms[sizeof(typenames) / sizeof(typenames[0])];
+
+    int i;
+    struct treenode* node = zparse_keywords(cur, end, kinds);
+    for (i = 0; !node && typenames[i] && zparse_kindat(cur) == ZKIND_ID; ++i) {
+        if (!atoms[i]) {
+            atoms[i] = zatom_get(typenames[i], zstrlen(typenames[i]));
+        }
+        node = zparse_atom(cur, end, atoms[i]);
+    }
+    return node;
 }
 
-static struct treenode* zparse_array(const char* str, char** end);
-static struct treenode* zparse_declstat(const char* str, char** end);
+static struct treenode* zparse_array(size_t cur, size_t* end);
+static struct treenode* zparse_declstat(size_t cur, size_t* end);
 
-static struct treenode* zparse_objstruct(const char* str, char** end)
+static struct treenode* zparse_objstruct(size_t cur, size_t* end)
 {
-    struct treenode* structnode = zparse_token(str, end, "struct");
+    struct treenode* structnode = zparse_kind(cur, end, ZKIND_STRUCT);
     if (structnode) {
         struct treenode* identifier;
         identifier = zparse_identifier(*end, end);
         if (!identifier) {
+            zparse_log_at(*end);
             zcc_log("Expected identifier after struct keyword.\n");
             zparse_free(structnode);
             return NULL;
         }
 
-        if (zparse_check(*end, end, '{')) {
+        if (zparse_check(*end, end, ZKIND_LBRACE)) {
             zparse_any(*end, end, &zparse_declstat, structnode);
-            if (!zparse_check(*end, end, '}')) {
+            if (!zparse_check(*end, end, ZKIND_RBRACE)) {
+                zparse_log_at(*end);
                 zcc_log("Expected } after struct definition.\n");
                 zparse_free(identifier);
                 zparse_free(structnode);
@@ -533,15 +568,16 @@ static struct treenode* zparse_objstruct(const char* str, char** end)
     return structnode;
 }
 
-static struct treenode* zparse_list(const char* str, char** end)
+static struct treenode* zparse_list(size_t cur, size_t* end)
 {
-    if (zparse_check(str, end, '{')) {
+    if (zparse_check(cur, end, ZKIND_LBRACE)) {
         struct token tok;
         struct treenode* list;
         tok = ztokstr("{}");
         list = treenode_create(&tok, sizeof(struct token));
-        zparse_enum(*end, end, &zparse_expr, ',', list);
-        if (!zparse_check(*end, end, '}')) {
+        zparse_enum(*end, end, &zparse_expr, ZKIND_COMMA, list);
+        if (!zparse_check(*end, end, ZKIND_RBRACE)) {
+            zparse_log_at(*end);
             zcc_log("Expected } after initializer list.\n");
             zparse_free(list);
             return NULL;
@@ -551,12 +587,13 @@ static struct treenode* zparse_list(const char* str, char** end)
     return NULL;
 }
 
-static struct treenode* zparse_assignment(const char* str, char** end, parser_f parser)
+static struct treenode* zparse_assignment(size_t cur, size_t* end, parser_f parser)
 {
-    struct treenode* assignment = zparse_char(str, end, '=');
+    struct treenode* assignment = zparse_kind(cur, end, ZKIND_ASSIGN);
     if (assignment) {
         struct treenode* expr = parser(*end, end);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Assignment not followed by expression when declaring variable.\n");
             zparse_free(assignment);
             return NULL;
@@ -567,9 +604,9 @@ static struct treenode* zparse_assignment(const char* str, char** end, parser_f
     return assignment;
 }
 
-static struct treenode* zparse_enumstat(const char* str, char** end)
+static struct treenode* zparse_enumstat(size_t cur, size_t* end)
 {
-    struct treenode* identifier = zparse_identifier(str, end);
+    struct treenode* identifier = zparse_identifier(cur, end);
     if (identifier) {
         struct treenode* assignment = zparse_assignment(*end, end, &zparse_constexpr);
         if (assignment) {
@@ -579,20 +616,22 @@ static struct treenode* zparse_enumstat(const char* str, char** end)
     return identifier;
 }
 
-static struct treenode* zparse_objenum(const char* str, char** end)
+static struct treenode* zparse_objenum(size_t cur, size_t* end)
 {
-    struct treenode* enumnode = zparse_token(str, end, "enum");
+    struct treenode* enumnode = zparse_kind(cur, end, ZKIND_ENUM);
     if (enumnode) {
         struct treenode* identifier = zparse_identifier(*end, end);
         if (!identifier) {
+            zparse_log_at(*end);
             zcc_log("Expected identifier after enum keyword.\n");
             zparse_free(enumnode);
             return NULL;
         }
 
-        if (zparse_check(*end, end, '{')) {
-            zparse_enum(*end, end, &zparse_enumstat, ',', enumnode);
-            if (!zparse_check(*end, end, '}')) {
+        if (zparse_check(*end, end, ZKIND_LBRACE)) {
+            zparse_enum(*end, end, &zparse_enumstat, ZKIND_COMMA, enumnode);
+            if (!zparse_check(*end, end, ZKIND_RBRACE)) {
+                zparse_log_at(*end);
                 zcc_log("Expected } after enum definition.\n");
                 zparse_free(identifier);
                 zparse_free(enumnode);
@@ -605,20 +644,22 @@ static struct treenode* zparse_objenum(const char* str, char** end)
     return enumnode;
 }
 
-static struct treenode* zparse_objunion(const char* str, char** end)
+static struct treenode* zparse_objunion(size_t cur, size_t* end)
 {
-    struct treenode* unionnode = zparse_token(str, end, "union");
+    struct treenode* unionnode = zparse_kind(cur, end, ZKIND_UNION);
     if (unionnode) {
         struct treenode* identifier = zparse_identifier(*end, end);
         if (!identifier) {
+            zparse_log_at(*end);
             zcc_log("Expected identifier after enum keyword.\n");
             zparse_free(unionnode);
             return NULL;
         }
 
-        if (zparse_check(*end, end, '{')) {
-            zparse_enum(*end, end, &zparse_enumstat, ',', unionnode);
-            if (!zparse_check(*end, end, '}')) {
+        if (zparse_check(*end, end, ZKIND_LBRACE)) {
+            zparse_enum(*end, end, &zparse_enumstat, ZKIND_COMMA, unionnode);
+            if (!zparse_check(*end, end, ZKIND_RBRACE)) {
+                zparse_log_at(*end);
                 zcc_log("Expected } after enum definition.\n");
                 zparse_free(identifier);
                 zparse_free(unionnode);
@@ -631,21 +672,23 @@ static struct treenode* zparse_objunion(const char* str, char** end)
     return unionnode;
 }
 
-static struct treenode* zparse_varid(const char* str, char** end);
-static struct treenode* zparse_declargs(const char* str, char** end);
+static struct treenode* zparse_varid(size_t cur, size_t* end);
+static struct treenode* zparse_declargs(size_t cur, size_t* end);
 
-static struct treenode* zparse_funcptr(const char* str, char** end)
+static struct treenode* zparse_funcptr(size_t cur, size_t* end)
 {
-    struct treenode* varid = zparse_paren(str, end, &zparse_varid);
+    struct treenode* varid = zparse_paren(cur, end, &zparse_varid);
     if (varid) {
-        if (!zparse_check(*end, end, '(')) {
+        if (!zparse_check(*end, end, ZKIND_LPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Invalid syntax for function pointers.\n");
             zparse_free(varid);
             return NULL;
         }
 
-        zparse_enum(*end, end, &zparse_declargs, ',', varid);
-        if (!zparse_check(*end, end, ')')) {
+        zparse_enum(*end, end, &zparse_declargs, ZKIND_COMMA, varid);
+        if (!zparse_check(*end, end, ZKIND_RPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Expected ) after function pointer declaration.\n");
             zparse_free(varid);
             varid = NULL;
@@ -654,7 +697,7 @@ static struct treenode* zparse_funcptr(const char* str, char** end)
     return varid;
 }
 
-static struct treenode* zparse_exprdecl(const char* str, char** end)
+static struct treenode* zparse_exprdecl(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_expr,
@@ -662,13 +705,13 @@ static struct treenode* zparse_exprdecl(const char* str, char** end)
         NULL
     };
 
-    return zparse_or(str, end, parsers);
+    return zparse_or(cur, end, parsers);
 }
 
-static struct treenode* zparse_indirection(const char* str, char** end)
+static struct treenode* zparse_indirection(size_t cur, size_t* end)
 {
     struct treenode* indirection, *qualifier, *rec;
-    indirection = zparse_char(str, end, '*');
+    indirection = zparse_kind(cur, end, ZKIND_STAR);
     if (!indirection) {
         return NULL;
     }
@@ -686,13 +729,14 @@ static struct treenode* zparse_indirection(const char* str, char** end)
     return indirection;
 }
 
-static struct treenode* zparse_array(const char* str, char** end)
+static struct treenode* zparse_array(size_t cur, size_t* end)
 {
-    if (zparse_check(str, end, '[')) {
+    if (zparse_check(cur, end, ZKIND_LBRACKET)) {
         struct token tok;
         struct treenode* expr, *node;
         expr = zparse_constexpr(*end, end);
-        if (!zparse_check(*end, end, ']')) {
+        if (!zparse_check(*end, end, ZKIND_RBRACKET)) {
+            zparse_log_at(*end);
             zcc_log("Expected ] at array declaration.\n");
             if (expr) {
                 zparse_free(expr);
@@ -709,7 +753,7 @@ static struct treenode* zparse_array(const char* str, char** end)
     return NULL;
 }
 
-static struct treenode* zparse_object(const char* str, char** end)
+static struct treenode* zparse_object(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_type,
@@ -719,7 +763,7 @@ static struct treenode* zparse_object(const char* str, char** end)
         NULL
     };
 
-    struct treenode* object = zparse_or(str, end, parsers);
+    struct treenode* object = zparse_or(cur, end, parsers);
     if (object) {
         struct treenode* indirection = zparse_indirection(*end, end);
         if (indirection) {
@@ -729,12 +773,12 @@ static struct treenode* zparse_object(const char* str, char** end)
     return object;
 }
 
-static struct treenode* zparse_varid(const char* str, char** end)
+static struct treenode* zparse_varid(size_t cur, size_t* end)
 {
     struct treenode* identifier, *indirection, *array;
-    indirection = zparse_indirection(str, end);
+    indirection = zparse_indirection(cur, end);
 
-    identifier = zparse_identifier(indirection ? *end : str, end);
+    identifier = zparse_identifier(indirection ? *end : cur, end);
     if (!identifier) {
         if (indirection) {
             zparse_free(indirection);
@@ -754,12 +798,12 @@ static struct treenode* zparse_varid(const char* str, char** end)
     return identifier;
 }
 
-static struct treenode* zparse_variable(const char* str, char** end)
+static struct treenode* zparse_variable(size_t cur, size_t* end)
 {
     struct treenode* var, *assignment;
-    var = zparse_varid(str, end);
+    var = zparse_varid(cur, end);
     if (!var) {
-        var = zparse_funcptr(str, end);
+        var = zparse_funcptr(cur, end);
         if (!var) {
             return NULL;
         }
@@ -773,7 +817,7 @@ static struct treenode* zparse_variable(const char* str, char** end)
     return var;
 }
 
-static struct treenode* zparse_decl(const char* str, char** end)
+static struct treenode* zparse_decl(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_storage,
@@ -784,8 +828,8 @@ static struct treenode* zparse_decl(const char* str, char** end)
     };
 
     struct treenode** chain, *type, *indirection = NULL;
-    chain = zparse_chain(str, end, parsers);
-    type = zparse_object(chain ? *end : str, end);
+    chain = zparse_chain(cur, end, parsers);
+    type = zparse_object(chain ? *end : cur, end);
 
     if (!type) {
         if (!chain) {
@@ -810,9 +854,9 @@ static struct treenode* zparse_decl(const char* str, char** end)
     return type;
 }
 
-static struct treenode* zparse_declstat(const char* str, char** end)
+static struct treenode* zparse_declstat(size_t cur, size_t* end)
 {
-    struct treenode* decl = zparse_decl(str, end);
+    struct treenode* decl = zparse_decl(cur, end);
     if (decl) {
         struct token tok;
         struct treenode *parent;
@@ -822,8 +866,9 @@ static struct treenode* zparse_declstat(const char* str, char** end)
         treenode_push(parent, decl);
         decl = parent;
         
-        zparse_enum(*end, end, &zparse_variable, ',', decl);
-        if (!zparse_check(*end, end, ';')) {
+        zparse_enum(*end, end, &zparse_variable, ZKIND_COMMA, decl);
+        if (!zparse_check(*end, end, ZKIND_SEMICOLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected ';' at the end of declaration.\n");
             zparse_free(decl);
             return NULL;
@@ -832,18 +877,18 @@ static struct treenode* zparse_declstat(const char* str, char** end)
     return decl;
 }
 
-static struct treenode* zparse_nullstat(const char* str, char** end)
+static struct treenode* zparse_nullstat(size_t cur, size_t* end)
 {
-    if (zparse_check(str, end, ';')) {
+    if (zparse_check(cur, end, ZKIND_SEMICOLON)) {
         struct token tok = ztokstr("null");
         return treenode_create(&tok, sizeof(struct token));
     }
     return NULL;
 }
 
-static struct treenode* zparse_exprdef(const char* str, char** end)
+static struct treenode* zparse_exprdef(size_t cur, size_t* end)
 {
-    struct treenode* expr = zparse_expr(str, end);
+    struct treenode* expr = zparse_expr(cur, end);
     if (expr) {
         struct token tok;
         struct treenode* parent;
@@ -853,17 +898,17 @@ static struct treenode* zparse_exprdef(const char* str, char** end)
         treenode_push(parent, expr);
         expr = parent;
 
-        if (zparse_check(*end, end, ',')) {
-            zparse_enum(*end, end, &zparse_expr, ',', expr);
+        if (zparse_check(*end, end, ZKIND_COMMA)) {
+            zparse_enum(*end, end, &zparse_expr, ZKIND_COMMA, expr);
         }
     }
 
-    return expr ? expr : zparse_nullstat(str, end);
+    return expr ? expr : zparse_nullstat(cur, end);
 }
 
-static struct treenode* zparse_exprstat(const char* str, char** end)
+static struct treenode* zparse_exprstat(size_t cur, size_t* end)
 {
-    struct treenode* expr = zparse_expr(str, end);
+    struct treenode* expr = zparse_expr(cur, end);
     if (expr) {
         struct token tok;
         struct treenode* parent;
@@ -873,11 +918,12 @@ static struct treenode* zparse_exprstat(const char* str, char** end)
         treenode_push(parent, expr);
         expr = parent;
 
-        if (zparse_check(*end, end, ',')) {
-            zparse_enum(*end, end, &zparse_expr, ',', expr);
+        if (zparse_check(*end, end, ZKIND_COMMA)) {
+            zparse_enum(*end, end, &zparse_expr, ZKIND_COMMA, expr);
         }
 
-        if (!zparse_check(*end, end, ';')) {
+        if (!zparse_check(*end, end, ZKIND_SEMICOLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected ';' after expression inside scope.\n");
             zparse_tree_print(expr, 0);
             zparse_free(expr);
@@ -885,12 +931,12 @@ static struct treenode* zparse_exprstat(const char* str, char** end)
         }
     }
 
-    return expr ? expr : zparse_nullstat(str, end);
+    return expr ? expr : zparse_nullstat(cur, end);
 }
 
-static struct treenode* zparse_return(const char* str, char** end)
+static struct treenode* zparse_return(size_t cur, size_t* end)
 {
-    struct treenode* retnode = zparse_token(str, end, "return");
+    struct treenode* retnode = zparse_kind(cur, end, ZKIND_RETURN);
     if (retnode) {
         struct treenode* expr;
         expr = zparse_expr(*end, end);
@@ -898,7 +944,8 @@ static struct treenode* zparse_return(const char* str, char** end)
             return retnode;
         }
 
-        if (!zparse_check(*end, end, ';')) {
+        if (!zparse_check(*end, end, ZKIND_SEMICOLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected ';' at the end of return expression.\n");
             zparse_free(retnode);
             zparse_free(expr);
@@ -910,12 +957,13 @@ static struct treenode* zparse_return(const char* str, char** end)
     return retnode;
 }
 
-static struct treenode* zparse_while_expr(const char* str, char** end)
+static struct treenode* zparse_while_expr(size_t cur, size_t* end)
 {
-    struct treenode* whilenode = zparse_token(str, end, "while");
+    struct treenode* whilenode = zparse_kind(cur, end, ZKIND_WHILE);
     if (whilenode) {
         struct treenode* expr = zparse_paren(*end, end, &zparse_expr);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected parenthesised expression after while kwyword.\n");
             zparse_free(whilenode);
             return NULL;
@@ -925,13 +973,13 @@ static struct treenode* zparse_while_expr(const char* str, char** end)
     return whilenode;
 }
 
-static struct treenode* zparse_statement(const char* str, char** end);
-static struct treenode* zparse_loopstat(const char* str, char** end);
-static struct treenode* zparse_switchstat(const char* str, char** end);
+static struct treenode* zparse_statement(size_t cur, size_t* end);
+static struct treenode* zparse_loopstat(size_t cur, size_t* end);
+static struct treenode* zparse_switchstat(size_t cur, size_t* end);
 
-static struct treenode* zparse_while(const char* str, char** end)
+static struct treenode* zparse_while(size_t cur, size_t* end)
 {
-    struct treenode* whilenode = zparse_while_expr(str, end);
+    struct treenode* whilenode = zparse_while_expr(cur, end);
     if (whilenode) {
         struct treenode* scope = zparse_loopstat(*end, end);
         if (scope) {
@@ -941,13 +989,14 @@ static struct treenode* zparse_while(const char* str, char** end)
     return whilenode;
 }
 
-static struct treenode* zparse_do(const char* str, char** end)
+static struct treenode* zparse_do(size_t cur, size_t* end)
 {
-    struct treenode* donode = zparse_token(str, end, "do");
+    struct treenode* donode = zparse_kind(cur, end, ZKIND_DO);
     if (donode) {
         struct treenode* scope, *whilenode;
         scope = zparse_loopstat(*end, end);
         if (!scope) {
+            zparse_log_at(*end);
             zcc_log("Expected scope to match do statement.\n");
             zparse_free(donode);
             return NULL;
@@ -956,6 +1005,7 @@ static struct treenode* zparse_do(const char* str, char** end)
         treenode_push(donode, scope);
         whilenode = zparse_while_expr(*end, end);
         if (!whilenode) {
+            zparse_log_at(*end);
             zcc_log("Expected while to match do statement.\n");
             zparse_free(donode);
             return NULL;
@@ -966,15 +1016,16 @@ static struct treenode* zparse_do(const char* str, char** end)
     return donode;
 }
 
-static struct treenode* zparse_else(const char* str, char** end);
+static struct treenode* zparse_else(size_t cur, size_t* end);
 
-static struct treenode* zparse_if(const char* str, char** end)
+static struct treenode* zparse_if(size_t cur, size_t* end)
 {
-    struct treenode* ifnode = zparse_token(str, end, "if");
+    struct treenode* ifnode = zparse_kind(cur, end, ZKIND_IF);
     if (ifnode) {
         struct treenode* expr, *scope, *elsenode;
         expr = zparse_paren(*end, end, &zparse_expr);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected parenthesised expression after if keyword.\n");
             zparse_free(ifnode);
             return NULL;
@@ -983,6 +1034,7 @@ static struct treenode* zparse_if(const char* str, char** end)
 
         scope = zparse_statement(*end, end);
         if (!scope) {
+            zparse_log_at(*end);
             zcc_log("Expected scope to match if statement.\n");
             zparse_free(ifnode);
             return NULL;
@@ -997,9 +1049,9 @@ static struct treenode* zparse_if(const char* str, char** end)
     return ifnode;
 }
 
-static struct treenode* zparse_else(const char* str, char** end)
+static struct treenode* zparse_else(size_t cur, size_t* end)
 {
-    struct treenode* elsenode = zparse_token(str, end, "else");
+    struct treenode* elsenode = zparse_kind(cur, end, ZKIND_ELSE);
     if (elsenode) {
         struct treenode* node;
         node = zparse_if(*end, end);
@@ -1016,14 +1068,15 @@ static struct treenode* zparse_else(const char* str, char** end)
     return elsenode;
 }
 
-static struct treenode* zparse_for(const char* str, char** end)
+static struct treenode* zparse_for(size_t cur, size_t* end)
 {
-    struct treenode* fornode = zparse_token(str, end, "for");
+    struct treenode* fornode = zparse_kind(cur, end, ZKIND_FOR);
     if (fornode) {
         int i;
         struct treenode* scope, *expr;
 
-        if (!zparse_check(*end, end, '(')) {
+        if (!zparse_check(*end, end, ZKIND_LPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Expected parenthesis after for keyword.\n");
             zparse_free(fornode);
             return NULL;
@@ -1032,6 +1085,7 @@ static struct treenode* zparse_for(const char* str, char** end)
         for (i = 0; i < 2; ++i) {
             expr = zparse_exprstat(*end, end);
             if (!expr) {
+                zparse_log_at(*end);
                 zcc_log("For loop must contain three expressions within declaration.\n");
                 zparse_free(fornode);
                 return NULL;
@@ -1041,13 +1095,15 @@ static struct treenode* zparse_for(const char* str, char** end)
 
         expr = zparse_exprdef(*end, end);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Invalid for loop syntax declaration.\n");
             zparse_free(fornode);
             return NULL;
         }
         treenode_push(fornode, expr);
 
-        if (!zparse_check(*end, end, ')')) {
+        if (!zparse_check(*end, end, ZKIND_RPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Expected closing parenthesis after for loop declaration.\n");
             zparse_free(fornode);
             return NULL;
@@ -1055,6 +1111,7 @@ static struct treenode* zparse_for(const char* str, char** end)
 
         scope = zparse_loopstat(*end, end);
         if (!scope) {
+            zparse_log_at(*end);
             zcc_log("Expected body after for loop declaration.\n");
             zparse_free(fornode);
             return NULL;
@@ -1065,19 +1122,21 @@ static struct treenode* zparse_for(const char* str, char** end)
     return fornode;
 }
 
-static struct treenode* zparse_goto(const char* str, char** end)
+static struct treenode* zparse_goto(size_t cur, size_t* end)
 {
-    struct treenode* gotonode = zparse_token(str, end, "goto");
+    struct treenode* gotonode = zparse_kind(cur, end, ZKIND_GOTO);
     if (gotonode) {
         struct treenode* identifier = zparse_identifier(*end, end);
         if (!identifier) {
+            zparse_log_at(*end);
             zcc_log("Expected label identifier after goto keyword.\n");
             zparse_free(gotonode);
             return NULL;
         }
         
         treenode_push(gotonode, identifier);
-        if (!zparse_check(*end, end, ';')) {
+        if (!zparse_check(*end, end, ZKIND_SEMICOLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected semicolon after goto statement.\n");
             zparse_free(gotonode);
             return NULL;
@@ -1086,20 +1145,21 @@ static struct treenode* zparse_goto(const char* str, char** end)
     return gotonode;
 }
 
-static struct treenode* zparse_label(const char* str, char** end)
+static struct treenode* zparse_label(size_t cur, size_t* end)
 {
-    struct treenode* label = zparse_identifier(str, end);
-    if (label && !zparse_check(*end, end, ':')) {
+    struct treenode* label = zparse_identifier(cur, end);
+    if (label && !zparse_check(*end, end, ZKIND_COLON)) {
         zparse_free(label);
         return NULL;
     }
     return label;
 }
 
-static struct treenode* zparse_continue(const char* str, char** end)
+static struct treenode* zparse_continue(size_t cur, size_t* end)
 {
-    struct treenode* contnode = zparse_token(str, end, "continue");
-    if (contnode && !zparse_check(*end, end, ';')) {
+    struct treenode* contnode = zparse_kind(cur, end, ZKIND_CONTINUE);
+    if (contnode && !zparse_check(*end, end, ZKIND_SEMICOLON)) {
+        zparse_log_at(*end);
         zcc_log("Expected semicolon after continue keyword.\n");
         zparse_free(contnode);
         return NULL;
@@ -1107,10 +1167,11 @@ static struct treenode* zparse_continue(const char* str, char** end)
     return contnode;
 }
 
-static struct treenode* zparse_break(const char* str, char** end)
+static struct treenode* zparse_break(size_t cur, size_t* end)
 {
-    struct treenode* breaknode = zparse_token(str, end, "break");
-    if (breaknode && !zparse_check(*end, end, ';')) {
+    struct treenode* breaknode = zparse_kind(cur, end, ZKIND_BREAK);
+    if (breaknode && !zparse_check(*end, end, ZKIND_SEMICOLON)) {
+        zparse_log_at(*end);
         zcc_log("Expected semicolon after break keyword.\n");
         zparse_free(breaknode);
         return NULL;
@@ -1118,20 +1179,23 @@ static struct treenode* zparse_break(const char* str, char** end)
     return breaknode;
 }
 
-static struct treenode* zparse_case(const char* str, char** end)
+static struct treenode* zparse_case(size_t cur, size_t* end)
 {
-    struct treenode* casenode = zparse_token(str, end, "case");
+    struct treenode* casenode = zparse_kind(cur, end, ZKIND_CASE);
     if (casenode) {
         struct treenode* constexpr = zparse_constexpr(*end, end);
         if (!constexpr) {
+            struct token tok = zparse_at(*end);
+            zparse_log_at(*end);
             zcc_log("Expected constant expression after case keyword.\n");
-            zcc_log("%s\n", *end);
+            zcc_log("%s\n", ztokbuf(&tok));
             zparse_free(casenode);
             return NULL;
         }
 
         treenode_push(casenode, constexpr);
-        if (!zparse_check(*end, end, ':')) {
+        if (!zparse_check(*end, end, ZKIND_COLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected semicolon after case statement.\n");
             zparse_free(casenode);
             return NULL;
@@ -1140,11 +1204,12 @@ static struct treenode* zparse_case(const char* str, char** end)
     return casenode;
 }
 
-static struct treenode* zparse_default(const char* str, char** end)
+static struct treenode* zparse_default(size_t cur, size_t* end)
 {
-    struct treenode* defaultnode = zparse_token(str, end, "default");
+    struct treenode* defaultnode = zparse_kind(cur, end, ZKIND_DEFAULT);
     if (defaultnode) {
-        if (!zparse_check(*end, end, ':')) {
+        if (!zparse_check(*end, end, ZKIND_COLON)) {
+            zparse_log_at(*end);
             zcc_log("Expected semicolon after default statement.\n");
             zparse_free(defaultnode);
             return NULL;
@@ -1153,15 +1218,16 @@ static struct treenode* zparse_default(const char* str, char** end)
     return defaultnode;
 }
 
-static struct treenode* zparse_switchscope(const char* str, char** end);
+static struct treenode* zparse_switchscope(size_t cur, size_t* end);
 
-static struct treenode* zparse_switch(const char* str, char** end)
+static struct treenode* zparse_switch(size_t cur, size_t* end)
 {
-    struct treenode* switchnode = zparse_token(str, end, "switch");
+    struct treenode* switchnode = zparse_kind(cur, end, ZKIND_SWITCH);
     if (switchnode) {
         struct treenode* expr;
         expr = zparse_paren(*end, end, &zparse_expr);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected parenthesised expression after switch keyword.\n");
             zparse_free(expr);
             return NULL;
@@ -1170,6 +1236,7 @@ static struct treenode* zparse_switch(const char* str, char** end)
 
         expr = zparse_switchscope(*end, end);
         if (!expr) {
+            zparse_log_at(*end);
             zcc_log("Expected body after switch declaration.\n");
             zparse_free(switchnode);
             return NULL;
@@ -1180,28 +1247,32 @@ static struct treenode* zparse_switch(const char* str, char** end)
     return switchnode;
 }
 
-static struct treenode* zparse_scope(const char* str, char** end);
-static struct treenode* zparse_loopscope(const char* str, char** end);
+static struct treenode* zparse_scope(size_t cur, size_t* end);
+static struct treenode* zparse_loopscope(size_t cur, size_t* end);
 
-static struct treenode* zparse_stat(const char* str, char** end)
+static struct treenode* zparse_stat(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
-        &zparse_if,
-        &zparse_while,
-        &zparse_do,
-        &zparse_for,
-        &zparse_switch,
-        &zparse_return,
-        &zparse_goto,
         &zparse_label,
         &zparse_exprstat,
         NULL
     };
 
-    return zparse_or(str, end, parsers);
+    struct treenode* node = NULL;
+    switch (zparse_kindat(cur)) {
+        case ZKIND_IF: node = zparse_if(cur, end); break;
+        case ZKIND_WHILE: node = zparse_while(cur, end); break;
+        case ZKIND_DO: node = zparse_do(cur, end); break;
+        case ZKIND_FOR: node = zparse_for(cur, end); break;
+        case ZKIND_SWITCH: node = zparse_switch(cur, end); break;
+        case ZKIND_RETURN: node = zparse_return(cur, end); break;
+        case ZKIND_GOTO: node = zparse_goto(cur, end); break;
+    }
+
+    return node ? node : zparse_or(cur, end, parsers);
 }
 
-static struct treenode* zparse_statement(const char* str, char** end)
+static struct treenode* zparse_statement(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_stat,
@@ -1209,23 +1280,22 @@ static struct treenode* zparse_statement(const char* str, char** end)
         NULL
     };
 
-    return zparse_or(str, end, parsers);
+    return zparse_or(cur, end, parsers);
 }
 
-static struct treenode* zparse_loopstat(const char* str, char** end)
+static struct treenode* zparse_loopstat(size_t cur, size_t* end)
 {
-    static const parser_f parsers[] = {
-        &zparse_break,
-        &zparse_continue,
-        &zparse_loopscope,
-        &zparse_stat,
-        NULL
-    };
+    struct treenode* node = NULL;
+    switch (zparse_kindat(cur)) {
+        case ZKIND_BREAK: node = zparse_break(cur, end); break;
+        case ZKIND_CONTINUE: node = zparse_continue(cur, end); break;
+        case ZKIND_LBRACE: node = zparse_loopscope(cur, end); break;
+    }
 
-    return zparse_or(str, end, parsers);
+    return node ? node : zparse_stat(cur, end);
 }
 
-static struct treenode* zparse_switchstat(const char* str, char** end)
+static struct treenode* zparse_switchstat(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_case,
@@ -1234,28 +1304,29 @@ static struct treenode* zparse_switchstat(const char* str, char** end)
         NULL
     };
 
-    return zparse_or(str, end, parsers);
+    return zparse_or(cur, end, parsers);
 }
 
-static struct treenode* zparse_body(const char* str, char** end, parser_f declparser, parser_f statparser)
+static struct treenode* zparse_body(size_t cur, size_t* end, parser_f declparser, parser_f statparser)
 {
     struct treenode* body, *decls = NULL;
     struct token tok = ztokstr("{}");
     body = treenode_create(&tok, sizeof(struct token));
 
-    decls = zparse_any(str, end, declparser, body);
+    decls = zparse_any(cur, end, declparser, body);
     if (statparser) {
-        zparse_any(decls ? *end : str, end, statparser, body);
+        zparse_any(decls ? *end : cur, end, statparser, body);
     }
     
     return body;
 }
 
-static struct treenode* zparse_brackets(const char* str, char** end, parser_f declparser, parser_f statparser)
+static struct treenode* zparse_brackets(size_t cur, size_t* end, parser_f declparser, parser_f statparser)
 {
-    if (zparse_check(str, end, '{')) {
+    if (zparse_check(cur, end, ZKIND_LBRACE)) {
         struct treenode *body = zparse_body(*end, end, declparser, statparser);
-        if (body && !zparse_check(*end, end, '}')) {
+        if (body && !zparse_check(*end, end, ZKIND_RBRACE)) {
+            zparse_log_at(*end);
             zcc_log("Expected '}' at the end of scope.\n");
             zparse_free(body);
             return NULL;
@@ -1265,24 +1336,24 @@ static struct treenode* zparse_brackets(const char* str, char** end, parser_f de
     return NULL;
 }
 
-static struct treenode* zparse_scope(const char* str, char** end)
+static struct treenode* zparse_scope(size_t cur, size_t* end)
 {
-    return zparse_brackets(str, end, &zparse_declstat, &zparse_statement);
+    return zparse_brackets(cur, end, &zparse_declstat, &zparse_statement);
 }
 
-static struct treenode* zparse_loopscope(const char* str, char** end)
+static struct treenode* zparse_loopscope(size_t cur, size_t* end)
 {
-    return zparse_brackets(str, end, &zparse_declstat, &zparse_loopstat);
+    return zparse_brackets(cur, end, &zparse_declstat, &zparse_loopstat);
 }
 
-static struct treenode* zparse_switchscope(const char* str, char** end)
+static struct treenode* zparse_switchscope(size_t cur, size_t* end)
 {
-    return zparse_brackets(str, end, &zparse_switchstat, NULL);
+    return zparse_brackets(cur, end, &zparse_switchstat, NULL);
 }
 
-static struct treenode* zparse_declargs(const char* str, char** end)
+static struct treenode* zparse_declargs(size_t cur, size_t* end)
 {
-    struct treenode* decl = zparse_decl(str, end);
+    struct treenode* decl = zparse_decl(cur, end);
     if (decl) {
         struct treenode* identifier = zparse_identifier(*end, end);
         if (identifier) {
@@ -1292,9 +1363,9 @@ static struct treenode* zparse_declargs(const char* str, char** end)
     return decl;
 }
 
-static struct treenode* zparse_funcsign(const char* str, char** end)
+static struct treenode* zparse_funcsign(size_t cur, size_t* end)
 {
-    struct treenode* decl = zparse_decl(str, end);
+    struct treenode* decl = zparse_decl(cur, end);
     if (decl) {
         struct treenode* identifier = zparse_identifier(*end, end);
         if (!identifier) {
@@ -1304,13 +1375,14 @@ static struct treenode* zparse_funcsign(const char* str, char** end)
         treenode_push(identifier, decl);
         decl = identifier;
 
-        if (!zparse_check(*end, end, '(')) {
+        if (!zparse_check(*end, end, ZKIND_LPAREN)) {
             zparse_free(decl);
             return NULL;
         }
 
-        zparse_enum(*end, end, &zparse_declargs, ',', decl);
-        if (!zparse_check(*end, end, ')')) {
+        zparse_enum(*end, end, &zparse_declargs, ZKIND_COMMA, decl);
+        if (!zparse_check(*end, end, ZKIND_RPAREN)) {
+            zparse_log_at(*end);
             zcc_log("Expected ) after function parameter declaration.\n");
             zparse_free(decl);
             return NULL;
@@ -1319,13 +1391,14 @@ static struct treenode* zparse_funcsign(const char* str, char** end)
     return decl;
 }
 
-static struct treenode* zparse_func(const char* str, char** end)
+static struct treenode* zparse_func(size_t cur, size_t* end)
 {
-    struct treenode* func = zparse_funcsign(str, end);
+    struct treenode* func = zparse_funcsign(cur, end);
     if (func) {
-        if (!zparse_check(*end, end, ';')) {
+        if (!zparse_check(*end, end, ZKIND_SEMICOLON)) {
             struct treenode* scope = zparse_scope(*end, end);
             if (!scope) {
+                zparse_log_at(*end);
                 zcc_log("Expected scope or semicolon after function declaration.\n");
                 zparse_free(func);
                 return NULL;
@@ -1336,7 +1409,7 @@ static struct treenode* zparse_func(const char* str, char** end)
     return func;
 }
 
-static struct treenode* zparse_modulestat(const char* str, char** end)
+static struct treenode* zparse_modulestat(size_t cur, size_t* end)
 {
     static const parser_f parsers[] = {
         &zparse_func,
@@ -1344,25 +1417,57 @@ static struct treenode* zparse_modulestat(const char* str, char** end)
         NULL
     };
 
-    return zparse_or(str, end, parsers);
+    return zparse_or(cur, end, parsers);
 }
 
 /* Interface */
 
-struct treenode* zparse_module(const char* str, char** end)
+struct treenode* zparse_module_tokens(const struct tokarray* toks, size_t* end)
 {
     struct token tok;
     struct treenode* module;
+    struct zsrcmap map;
+    const int own = !zparse_map;
     tok = ztokstr("module");
     module = treenode_create(&tok, sizeof(struct token));
-    zparse_any(str, end, &zparse_modulestat, module);
+    ztoks = toks;
+    if (own) {
+        map = zsrcmap_create("<source>");
+        zparse_map = &map;
+    }
+    zparse_any(*end, end, &zparse_modulestat, module);
+    if (own) {
+        zsrcmap_free(&map);
+        zparse_map = NULL;
+    }
     return module;
 }
 
-struct treenode* zparse_source(const char* str)
+struct treenode* zparse_source_tokens(const struct tokarray* toks)
 {
+    size_t end = 0;
+    return zparse_module_tokens(toks, &end);
+}
+
+struct treenode* zparse_module(const char* str, char** end)
+{
+    size_t index = 0;
+    struct treenode* module;
+    struct tokarray toks = zcc_tokenize_parallel(str, zcc_lexthreads);
+    module = zparse_module_tokens(&toks, &index);
+    *end = (char*)(size_t)toks.src + toks.offsets[index];
+    ztoks_free(&toks);
+    return module;
+}
+
+struct treenode* zparse_source(struct zsrcmap* map, const char* str)
+{
+    struct treenode* module;
     char* end = (char*)(size_t)str;
-    return zparse_module(str, &end);
+    zparse_map = map;
+    module = zparse_module(str, &end);
+    zparse_map = NULL;
+    return module;
 }
 
 void zparse_free(struct treenode* node)
@@ -1385,9 +1490,22 @@ void zparse_free(struct treenode* node)
     }
 }
 
+/* Integer and character operands fold, floating ones are left alone */
+static int zparse_foldable(const struct token* tok, long* val)
+{
+    struct zlit lit;
+    if (tok->kind != ZKIND_NUM && tok->kind != ZKIND_CHR) {
+        return 0;
+    }
+
+    lit = ztokval(tok);
+    *val = lit.val.i;
+    return lit.type == ZLIT_INT || lit.type == ZLIT_CHAR;
+}
+
 void zparse_reduce(struct treenode* root)
 {
-    long i;
+    long i, l, r;
     const struct token *op;
     if (!root || !root->children[0]) {
         return;
@@ -1399,26 +1517,23 @@ void zparse_reduce(struct treenode* root)
 
     op = root->data;
     if (op->type == ZTOK_SYM) {
-        const struct token* lhs, *rhs;
-        lhs = root->children[0]->data;
-        if (lhs->type != ZTOK_NUM && (lhs->type != ZTOK_DEF || !_isdigit(lhs->str[0]))) {
+        if (!zparse_foldable(root->children[0]->data, &l)) {
             return;
         }
 
         if (!root->children[1]) {
-            struct token tok = ztoknum(zsolve_unary(zatol(ztokbuf(lhs)), op->str));
+            struct token tok = ztoknum(zsolve_unary(l, op->str));
             zparse_free(root->children[0]);
             root->children[0] = NULL;
             zmemcpy(root->data, &tok, sizeof(struct token));
             return;
         } 
         
-        rhs = root->children[1]->data;
-        if (rhs->type == ZTOK_NUM || rhs->type == ZTOK_DEF) {
-            struct token tok = ztoknum(zsolve_binary(zatol(ztokbuf(lhs)), zatol(ztokbuf(rhs)), op->str));
+        if (zparse_foldable(root->children[1]->data, &r)) {
+            struct token tok = ztoknum(zsolve_binary(l, r, op->str));
             zparse_free(root->children[0]);
             zparse_free(root->children[1]);
-            zmemset(root->children, 0, sizeof(struct token) * 2);
+            root->children[0] = root->children[1] = NULL;
             zmemcpy(root->data, &tok, sizeof(struct token));
         }
     }
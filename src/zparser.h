@@ -40,11 +40,15 @@ type := <indirection> <type> |  ("char" | "int" | "void") | EMPTY
 */
 
 #include <utopia/tree.h>
+#include <ztoken.h>
+#include <zsource.h>
 
 void zparse_tree_print(const struct treenode* node, const size_t lvl);
 void zparse_free(struct treenode* node);
 void zparse_reduce(struct treenode* node);
-struct treenode* zparse_source(const char* str);
+struct treenode* zparse_source(struct zsrcmap* map, const char* str);
 struct treenode* zparse_module(const char* str, char** end);
+struct treenode* zparse_source_tokens(const struct tokarray* toks);
+struct treenode* zparse_module_tokens(const struct tokarray* toks, size_t* end);
 
 #endif /* ZCC_PARSER_H */
@@ -1,84 +1,188 @@
 #include <zpreprocessor.h>
 #include <zlexer.h>
-#include <zsolver.h>
 #include <zio.h>
 #include <zstdlib.h>
 #include <zdbg.h>
 #include <zstring.h>
 #include <zintrinsics.h>
+#include <zsource.h>
+#include <zatom.h>
+#include <zscan.h>
+#include <zheader.h>
+#include <zinclude.h>
 
 int zcc_printdefines = 0;
 int zcc_precomments = 1;
 
-static struct string string_wrap_sized(char* str, const size_t size)
+/* Text being preprocessed is read from a stack of inputs, one for each
+ * include level, and written to a separate output that only grows at its
+ * end. Inputs are read a line at a time and never changed. Each has a
+ * source map resolving its offsets back to file and line. The start of
+ * the line being processed is the location reported when an error has no
+ * position in the input. Open conditionals remember the input they were
+ * opened in and whether a group of theirs was kept. The output has a map
+ * of its own, mark is the next mark of an input map it has not seen and
+ * next the line that goes on from the last one written. */
+struct zcc_input {
+    const char* data;
+    const char* end;
+    const char* cur;
+    struct zsrcmap map;
+    struct zheader* header;
+    size_t mark;
+    const char* name;
+    const char* outname;
+};
+
+struct zcc_cond {
+    size_t line;
+    size_t input;
+    int taken;
+};
+
+static struct zcc_source {
+    struct vector inputs;
+    struct vector conds;
+    struct zcc_input* in;
+    size_t line;
+    unsigned int unit;
+    struct vector dirs;
+    struct zsrcmap out;
+    const char* next;
+    struct vector* headers;
+} zcc_src;
+
+/* Header read by a unit and the path it was opened by */
+struct zcc_entered {
+    struct zheader* header;
+    const char* path;
+};
+
+static struct zsrcloc zcc_locate(const size_t offset)
 {
-    struct string string;
-    string.data = str;
-    string.capacity = size + 1;
-    string.size = size;
-    return string;
+    return zsrcmap_locate(&zcc_src.in->map, zcc_src.in->data, offset);
 }
 
-static struct vector vector_wrap_sized(void* data, const size_t size, const size_t bytes)
+static void zcc_log_at(const char* at)
 {
-    struct vector vector;
-    vector.data = data;
-    vector.bytes = bytes;
-    vector.capacity = size + 1;
-    vector.size = size;
-    return vector;
+    size_t offset;
+    const struct zcc_input* in = zcc_src.in;
+    if (!in) {
+        return;
+    }
+
+    offset = zcc_src.line;
+    if (at >= in->data && at < in->end) {
+        offset = at - in->data;
+    }
+    zsrcloc_log(zcc_locate(offset));
 }
 
-static void string_push_tok(struct string* string, const struct token tok)
+/* Headers are read from the header cache and stay mapped */
+static void zcc_input_push(const char* data, const size_t size, struct zsrcmap map, struct zheader* header)
 {
-    string_push(string, zstrbuf(tok.str, tok.len));
+    struct zcc_input in;
+    in.data = data;
+    in.end = data + size;
+    in.cur = data;
+    in.map = map;
+    in.header = header;
+    in.mark = 0;
+    in.name = NULL;
+    in.outname = NULL;
+    vector_push(&zcc_src.inputs, &in);
+    zcc_src.in = vector_peek(&zcc_src.inputs);
 }
 
-static void string_wipe(struct string* string)
+static void zcc_input_pop(void)
 {
-    size_t i;
-    for (i = 0; string->data[i]; ++i) {
-        if (string->data[i] == ' ') {
-            while (string->data[i] == ' ') {
-                string_remove_index(string, i);
-            }
-            string_push_at(string, " ", i++);
-        }
+    struct zcc_input* in = zcc_src.in;
+    const struct zcc_cond* cond;
+
+    /* conditionals may not go on past the end of their file */
+    while (zcc_src.conds.size && (cond = vector_peek(&zcc_src.conds))->input == zcc_src.inputs.size) {
+        zsrcloc_log(zcc_locate(cond->line));
+        zcc_log("Missing closing #endif directive.\n");
+        --zcc_src.conds.size;
     }
+
+    zsrcmap_free(&in->map);
+    --zcc_src.inputs.size;
+    zcc_src.in = zcc_src.inputs.size ? vector_peek(&zcc_src.inputs) : NULL;
 }
 
-static void string_remove_trail(struct string* string)
+/* File names of output marks are strings of the output map, the one an
+ * input used last is kept at hand */
+static void zcc_output_mark(const size_t offset, struct zsrcloc loc)
 {
-    if (string->size) {
-        size_t len = string->size - 1;
-        while (len && _isspace(string->data[len])) {
-            --len;
-        }
-        string_remove_range(string, len + 1, string->size);
+    struct zcc_input* in = zcc_src.in;
+    if (loc.name != in->name) {
+        in->name = loc.name;
+        in->outname = zsrcmap_name(&zcc_src.out, loc.name);
+    }
+    loc.name = in->outname;
+    zsrcmap_mark(&zcc_src.out, offset, loc);
+}
+
+/* Output lines follow the lines of an input until inputs switch, a line
+ * leaves no output or the input map has a mark of its own. Those lines
+ * get a mark, which is then needed before the line is processed. */
+static int zcc_output_remark(const char* linestart)
+{
+    struct zcc_input* in = zcc_src.in;
+    const struct zsrcmark* marks = in->map.marks.data;
+    const size_t offset = linestart - in->data;
+    int remark = linestart != zcc_src.next;
+    for (; in->mark < in->map.marks.size && marks[in->mark].offset <= offset; ++in->mark) {
+        remark = 1;
     }
+    return remark;
 }
 
-static void string_push_space(struct string* string, const struct token tok, const char* next)
+/* Maps output [from, to) written for a line of the current input. Lines
+ * copied as they are keep the marks inside them. */
+static void zcc_output_line(const int remark, const size_t from, const size_t to, const char* linestart, const char* lineend)
 {
-    const char* p = tok.str + tok.len;
-    string_push(string, zstrbuf(p, next - p));
+    size_t i;
+    struct zsrcloc loc;
+    const struct zcc_input* in = zcc_src.in;
+    const struct zsrcmark* marks = in->map.marks.data;
+    const size_t offset = linestart - in->data, len = lineend + !!*lineend - linestart;
+
+    if (remark) {
+        zcc_output_mark(from, zcc_locate(offset));
+    }
+    if (to - from == len) {
+        for (i = in->mark; i < in->map.marks.size && marks[i].offset < offset + len; ++i) {
+            loc.name = marks[i].name;
+            loc.line = marks[i].line;
+            loc.column = 1;
+            zcc_output_mark(from + marks[i].offset - offset, loc);
+        }
+    }
+    zcc_src.next = linestart + len;
 }
 
-static struct string zcc_concatenate(const struct token t1, const struct token t2)
+static void string_push_sized(struct string* string, const char* str, const size_t size)
 {
-    struct string s = string_ranged(t1.str, t1.str + t1.len);
-    string_push_tok(&s, t2);
-    return s;
+    if (string->size + size + 1 > string->capacity) {
+        string->capacity = (string->size + size + 1) * 2;
+        string->data = zrealloc(string->data, string->capacity);
+    }
+    zmemcpy(string->data + string->size, str, size);
+    string->size += size;
+    string->data[string->size] = 0;
 }
 
-static void string_insert_before(struct string* string, const char mark, const char insert)
+static void string_wipe(struct string* string)
 {
     size_t i;
-    char in[2] = {0, 0};
-    in[0] = insert;
-    for (i = 0; i < string->size; ++i) {
-        if (string->data[i] == mark) {
-            string_push_at(string, in, i++);
+    for (i = 0; string->data[i]; ++i) {
+        if (string->data[i] == ' ') {
+            while (string->data[i] == ' ') {
+                string_remove_index(string, i);
+            }
+            string_push_at(string, " ", i);
         }
     }
 }
@@ -89,7 +193,7 @@ typedef struct zmacro_t {
     struct vector body;
 } zmacro_t;
 
-static int zmacro_args(struct vector* args, struct string* string, struct token tok, const size_t linecount)
+static int zmacro_args(struct vector* args, struct string* string, struct token tok)
 {
     static const char vdots[] = "...", vargs[] = "__VA_ARGS__";
 
@@ -97,7 +201,8 @@ static int zmacro_args(struct vector* args, struct string* string, struct token
         if (*tok.str == ',') {
             tok = ztok_next(tok);
             if (*tok.str == ')' || *tok.str == ',') {
-                zcc_log("Macro function definition does not allow empty argument parameter at line %zu.\n", linecount);
+                zcc_log_at(NULL);
+                zcc_log("Macro function definition does not allow empty argument parameter.\n");
                 return Z_EXIT_FAILURE;
             }
             continue;
@@ -106,7 +211,8 @@ static int zmacro_args(struct vector* args, struct string* string, struct token
         if (!zmemcmp(tok.str, vdots, sizeof(vdots) - 1)) {
             size_t n;
             if (tok.str[sizeof(vdots) - 1] != ')') {
-                zcc_log("Missing ')' in macro parameter list at line %zu.\n", linecount);
+                zcc_log_at(NULL);
+                zcc_log("Missing ')' in macro parameter list.\n");
                 return Z_EXIT_FAILURE;
             }
             n = tok.str - string->data;
@@ -115,9 +221,11 @@ static int zmacro_args(struct vector* args, struct string* string, struct token
             tok.type = ZTOK_ID;
             tok.str = string->data + n;
             tok.len = sizeof(vargs) - 1;
+            tok.atom = zatom_get(vargs, tok.len);
         }
         else if (!_isid(*tok.str)) {
-            zcc_log("Macro function definition only allows valid identifiers as argument parameter at line %zu.\n", linecount);
+            zcc_log_at(NULL);
+            zcc_log("Macro function definition only allows valid identifiers as argument parameter.\n");
             zabort();
             return Z_EXIT_FAILURE;
         }
@@ -126,21 +234,25 @@ static int zmacro_args(struct vector* args, struct string* string, struct token
     }
 
     if (!tok.str || *tok.str != ')') {
-        zcc_log("Macro function definition does not close parenthesis at line %zu.\n", linecount);
+        zcc_log_at(NULL);
+        zcc_log("Macro function definition does not close parenthesis.\n");
         return Z_EXIT_FAILURE;
     }
 
     return Z_EXIT_SUCCESS;
 }
 
+/* A macro string with no capacity is borrowed from a precompiled header */
 static void zmacro_free(zmacro_t* macro)
 {
-    string_free(&macro->str);
+    if (macro->str.capacity) {
+        string_free(&macro->str);
+    }
     vector_free(&macro->args);
     vector_free(&macro->body);
 }
 
-static zmacro_t zmacro_create(const char* str, const size_t linecount)
+static zmacro_t zmacro_create(const char* str)
 {
     struct token tok;
     zmacro_t macro;
@@ -164,7 +276,7 @@ static zmacro_t zmacro_create(const char* str, const size_t linecount)
 
     /* macro function */
     tok = ztok_get(macro.str.data);
-    if (zmacro_args(&macro.args, &macro.str, ztok_next(tok), linecount)) {
+    if (zmacro_args(&macro.args, &macro.str, ztok_next(tok))) {
         zmacro_free(&macro);
         return macro;
     }
@@ -180,36 +292,131 @@ static zmacro_t zmacro_create(const char* str, const size_t linecount)
     return macro;
 }
 
-int zcc_defines_push(struct map* defines, const char* keystr, const char* valstr)
+/* Definitions are stored with the atom of their name, dead ones have an
+ * atom of 0 and keep their slot so probing goes on past them */
+struct zmacro_def {
+    unsigned int atom;
+    zmacro_t macro;
+};
+
+static unsigned int zcc_macro_hash(const unsigned int atom)
+{
+    return atom * 0x9e3779b1u;
+}
+
+static struct zmacro_def* zcc_macro_defs(const struct zmacros* defines)
 {
-    zmacro_t body;
-    struct string key = string_create(keystr);
-    body = zmacro_create(valstr, 0);
-    if (map_push_if(defines, &key, &body)) {
-        zcc_log("Macro redefinition is not allowed (%s).\n", keystr);
-        string_free(&key);
-        zmacro_free(&body);
-        return Z_EXIT_FAILURE;
+    return defines->defs.data;
+}
+
+static void zcc_macros_rehash(struct zmacros* defines)
+{
+    size_t i;
+    unsigned int j;
+    const struct zmacro_def* defs = zcc_macro_defs(defines);
+    const unsigned int size = defines->mask ? (defines->mask + 1) * 2 : 0x100;
+
+    if (defines->slots) {
+        zfree(defines->slots);
+    }
+    defines->slots = zmalloc(size * sizeof(unsigned int));
+    zmemset(defines->slots, 0, size * sizeof(unsigned int));
+    defines->mask = size - 1;
+
+    for (i = 0; i < defines->defs.size; ++i) {
+        if (defs[i].atom) {
+            j = zcc_macro_hash(defs[i].atom) & defines->mask;
+            for (; defines->slots[j]; j = (j + 1) & defines->mask);
+            defines->slots[j] = (unsigned int)i + 1;
+        }
+    }
+}
+
+/* Index of the definition of the identifier plus one, 0 if it is not a
+ * macro. Atoms never defined in this table are turned down by their bit
+ * without probing. */
+static size_t zcc_macro_find(const struct zmacros* defines, const struct token tok)
+{
+    unsigned int i, slot;
+    const struct zmacro_def* defs = zcc_macro_defs(defines);
+    const unsigned int atom = tok.atom ? tok.atom : _isid(*tok.str) ? zatom_get(tok.str, tok.len) : 0;
+    if (atom / 8 >= defines->bitsize || !(defines->bits[atom / 8] & (1 << (atom % 8)))) {
+        return 0;
+    }
+
+    i = zcc_macro_hash(atom) & defines->mask;
+    for (; (slot = defines->slots[i]); i = (i + 1) & defines->mask) {
+        if (defs[slot - 1].atom == atom) {
+            return slot;
+        }
+    }
+    return 0;
+}
+
+static zmacro_t* zcc_macro_at(const struct zmacros* defines, const size_t find)
+{
+    return &zcc_macro_defs(defines)[find - 1].macro;
+}
+
+static int zcc_defines_insert(struct zmacros* defines, const unsigned int atom, const zmacro_t* macro)
+{
+    unsigned int i, slot;
+    struct zmacro_def def;
+    const struct zmacro_def* defs;
+    
+    def.atom = atom;
+    if (2 * (defines->defs.size + 1) > defines->mask) {
+        zcc_macros_rehash(defines);
+    }
+
+    defs = zcc_macro_defs(defines);
+    i = zcc_macro_hash(def.atom) & defines->mask;
+    for (; (slot = defines->slots[i]); i = (i + 1) & defines->mask) {
+        if (defs[slot - 1].atom == def.atom) {
+            zcc_log("Macro redefinition is not allowed (%s).\n", zatom_str(atom));
+            return Z_EXIT_FAILURE;
+        }
+    }
+
+    if (def.atom / 8 >= defines->bitsize) {
+        const size_t size = def.atom / 8 * 2 + 0x100;
+        defines->bits = zrealloc(defines->bits, size);
+        zmemset(defines->bits + defines->bitsize, 0, size - defines->bitsize);
+        defines->bitsize = size;
     }
+    defines->bits[def.atom / 8] |= (unsigned char)(1 << (def.atom % 8));
+
+    def.macro = *macro;
+    vector_push(&defines->defs, &def);
+    defines->slots[i] = (unsigned int)defines->defs.size;
     return Z_EXIT_SUCCESS;
 }
 
-static size_t hash_string(const void* key)
+int zcc_defines_push(struct zmacros* defines, const char* keystr, const char* valstr)
 {
-    int c;
-    size_t hash = 5381;
-    const struct string* s = key;
-    char* str = s->data;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c;
+    zmacro_t macro = zmacro_create(valstr);
+    if (zcc_defines_insert(defines, zatom_get(keystr, zstrlen(keystr)), &macro)) {
+        zmacro_free(&macro);
+        return Z_EXIT_FAILURE;
     }
-    return hash;
+    return Z_EXIT_SUCCESS;
+}
+
+struct zmacros zcc_defines_create(void)
+{
+    struct zmacros defines;
+    defines.defs = vector_create(sizeof(struct zmacro_def));
+    defines.slots = NULL;
+    defines.mask = 0;
+    defines.bits = NULL;
+    defines.bitsize = 0;
+    defines.shared = 0;
+    return defines;
 }
 
-struct map zcc_defines_std(void)
+struct zmacros zcc_defines_std(void)
 {
-    struct map defines = map_create(sizeof(struct string), sizeof(zmacro_t));
-    map_overload(&defines, &hash_string);
+    struct zmacros defines = zcc_defines_create();
 
     zcc_defines_push(&defines, "__STDC__", "1");
     zcc_defines_push(&defines, "__STDC_HOSTED__", "0");
@@ -234,56 +441,93 @@ struct map zcc_defines_std(void)
     return defines;
 }
 
-void zcc_defines_free(struct map* defines, const size_t from)
+/* The copy shares the definitions already made, it only frees its own */
+struct zmacros zcc_defines_copy(const struct zmacros* defines)
+{
+    struct zmacros copy = zcc_defines_create();
+    const size_t slots = defines->mask + 1;
+    
+    vector_push_block(&copy.defs, defines->defs.data, defines->defs.size);
+    copy.shared = defines->defs.size;
+    
+    if (defines->slots) {
+        copy.slots = zmalloc(slots * sizeof(unsigned int));
+        zmemcpy(copy.slots, defines->slots, slots * sizeof(unsigned int));
+        copy.mask = defines->mask;
+    }
+
+    if (defines->bits) {
+        copy.bits = zmalloc(defines->bitsize);
+        zmemcpy(copy.bits, defines->bits, defines->bitsize);
+        copy.bitsize = defines->bitsize;
+    }
+    return copy;
+}
+
+void zcc_defines_free(struct zmacros* defines)
 {
     size_t i;
-    const size_t count = defines->size;
-    struct string* keys = defines->keys;
-    zmacro_t* defs = defines->values;
-    for (i = from; i < count; ++i) {
-        string_free(keys + i);
-        zmacro_free(defs + i);
+    struct zmacro_def* defs = zcc_macro_defs(defines);
+    for (i = defines->shared; i < defines->defs.size; ++i) {
+        if (defs[i].atom) {
+            zmacro_free(&defs[i].macro);
+        }
+    }
+
+    vector_free(&defines->defs);
+    if (defines->slots) {
+        zfree(defines->slots);
     }
-    map_free(defines);
+    if (defines->bits) {
+        zfree(defines->bits);
+    }
+    defines->slots = NULL;
+    defines->bits = NULL;
 }
 
-int zcc_defines_undef(struct map* defines, const char* key)
+int zcc_defines_undef(struct zmacros* defines, const char* key)
 {
-    zmacro_t* d;
-    struct string* k;
-    const size_t find = map_search(defines, &key);
+    struct token tok;
+    struct zmacro_def* def;
+    size_t find;
+
+    tok.str = key;
+    tok.len = (unsigned int)zstrlen(key);
+    tok.atom = zatom_get(key, tok.len);
+    find = zcc_macro_find(defines, tok);
     if (!find) {
         return Z_EXIT_FAILURE;
     }
 
-    k = map_key_at(defines, find - 1);
-    d = map_value_at(defines, find - 1);
-
-    map_remove(defines, k);
-    string_free(k);
-    zmacro_free(d);
-
+    /* the name stays set in the filter, which only turns down misses */
+    def = zcc_macro_defs(defines) + find - 1;
+    if (find > defines->shared) {
+        zmacro_free(&def->macro);
+    }
+    def->atom = 0;
     return Z_EXIT_SUCCESS;
 }
 
-static int zcc_undef(struct map* defines, struct token tok, const size_t linecount)
+static int zcc_undef(struct zmacros* defines, struct token tok)
 {
     tok = ztok_nextl(tok);
     if (!tok.str) {
-        zcc_log("Macro #undef is empty at line %zu.\n", linecount);
+        zcc_log_at(NULL);
+        zcc_log("Macro #undef is empty.\n");
         return Z_EXIT_FAILURE;
     }
     
     return zcc_defines_undef(defines, zstrbuf(tok.str, tok.len));
 }
 
-static int zcc_define(struct map* defines, struct token tok)
+static int zcc_define(struct zmacros* defines, struct token tok)
 {
     char buf[0xfff];
     const char *linestr, *end;
     tok = ztok_nextl(tok);
     if (!tok.str) {
-        zcc_log("Macro #define is empty at line %zu.\n");
+        zcc_log_at(NULL);
+        zcc_log("Macro #define is empty.\n");
         return Z_EXIT_FAILURE;
     }
 
@@ -299,636 +543,1749 @@ static int zcc_define(struct map* defines, struct token tok)
     return zcc_defines_push(defines, buf, tok.str + tok.len);
 }
 
-static struct token zcc_include(const char** includes, struct token tok, const size_t linecount)
+static struct zheader* zcc_include(struct token tok, const char** name)
 {
-    static char dir[0xfff] = "./";
-    const char* ch;
-    char filename[0xfff], buf[0xfff];
-    size_t dlen, flen, inclen, i;
-    struct token inc = {NULL, 0, ZTOK_DEF};
+    int fd = -1;
+    size_t i;
+    const char* from, *slash, *close;
+    unsigned int file;
+    const unsigned int* dirs = zcc_src.dirs.data;
     
     tok = ztok_nextl(tok);
     if (!tok.str) {
-        zcc_log("Macro directive #include is empty at line at line %zu.\n", linecount);
-        return inc;
+        zcc_log_at(NULL);
+        zcc_log("Macro directive #include is empty.\n");
+        return NULL;
     }
 
     if (*tok.str == '"') {
-        dlen = zstrlen(dir);
-        flen = tok.len - 2;
-        zmemcpy(filename, tok.str + 1, flen);
-        filename[flen] = 0;
-        zmemcpy(buf, dir, dlen);
-        zmemcpy(buf + dlen, filename, flen + 1);
-        inc.str = zcc_fread(buf, &inclen);
-        inc.len = (unsigned int)inclen;
-        return inc;
+        /* quoted names are looked for next to the including file first */
+        file = zatom_intern(tok.str + 1, tok.len - 2, zatom_hash(tok.str + 1, tok.len - 2));
+        from = zcc_locate(zcc_src.line).name;
+        slash = zstrrchr(from, '/');
+        fd = zinclude_open(slash ? zinclude_dir(from, slash > from ? slash - from : 1) : zinclude_dir(".", 1), file, name);
     }
-
-    if (*tok.str != '<') {
-        zcc_log("Macro directive #include must have \"\" or <> symbol at line %zu.'%s'\n", linecount, zstrbuf(tok.str, tok.len));
-        return inc;
+    else if (*tok.str == '<') {
+        close = zstrchr(tok.str, '>');
+        if (!close || close > zcc_lexline(tok.str)) {
+            zcc_log_at(tok.str);
+            zcc_log("Macro #include does not close '>' bracket.\n");
+            return NULL;
+        }
+        file = zatom_intern(tok.str + 1, close - tok.str - 1, zatom_hash(tok.str + 1, close - tok.str - 1));
     }
-
-    ch = zstrchr(tok.str, '>');
-    if (!ch) {
-        zcc_log("Macro #include does not close '>' bracket at line %zu.\n", linecount);
-        return inc;
+    else {
+        zcc_log_at(tok.str);
+        zcc_log("Macro directive #include must have \"\" or <> symbol.'%s'\n", zstrbuf(tok.str, tok.len));
+        return NULL;
     }
-    
-    flen = ch - tok.str - 1;
-    zmemcpy(filename, tok.str + 1, flen);
-    filename[flen] = 0;
 
-    for (i = 0; includes[i] && !inc.str; ++i) {
-        dlen = zstrlen(includes[i]);
-        zmemcpy(dir, includes[i], dlen);
-        if (dir[dlen - 1] != '/') {
-            dir[dlen++] = '/';
-        }
-        zmemcpy(buf, dir, dlen);
-        zmemcpy(buf + dlen, filename, flen + 1);
-        inc.str = zcc_fread(buf, &inclen);
-        inc.len = (unsigned int)inclen;
+    for (i = 0; fd < 0 && i < zcc_src.dirs.size; ++i) {
+        fd = zinclude_open(dirs[i], file, name);
     }
     
-    if (!inc.str) {
-        zcc_log("Could not open header file '%s' at line %zu.\n", filename, linecount);
+    if (fd < 0) {
+        zcc_log_at(tok.str);
+        zcc_log("Could not open header file '%s'.\n", zatom_str(file));
+        return NULL;
     }
     
-    return inc;
-}
-
-static struct string zcc_stringify(const struct vector* args)
-{
-    size_t i;
-    const struct token* toks = args->data;
-    struct string str = string_create("\"");
-    for (i = 0; i < args->size; ++i) {
-        
-        struct string s = string_ranged(toks[i].str, toks[i].str + toks[i].len);
-        switch (toks[i].str[0]) {
-            case '"':
-                string_insert_before(&s, '\\', '\\');
-                string_insert_before(&s, '"', '\\');
-                break;
-            case '\'':
-                string_insert_before(&s, '\\', '\\');
-        }
-
-        string_concat(&str, &s);
-        string_free(&s);
-
-        if (i + 1 < args->size && toks[i + 1].str > toks[i].str + toks[i].len) {
-            string_push(&str, " ");
-        }
-    }
-    string_push(&str, "\"");
-    return str;
+    return zheader_open(fd, *name);
 }
 
 size_t zcc_macro_search(const struct vector* params, const struct token tok)
 {
     size_t i = 0;
     const struct token* args = params->data;
+    if (!tok.atom) {
+        return 0;
+    }
+
     for (i = 0; i < params->size; ++i) {
-        if (tok.len == args[i].len && !zmemcmp(tok.str, args[i].str, tok.len)) {
+        if (tok.atom == args[i].atom) {
             return i + 1;
         }
     }
     return 0;
 }
 
-static struct string zcc_expand(const struct vector* tokens, const struct map* defines, size_t* refs, const size_t linecount)
-{
-    const char* close;
-    size_t refcount, bcount, find, found, perm, i, j;
+/* Macros are expanded on tokens after Prosser's algorithm. Each token
+ * being expanded carries its hide-set, the macros it came out of, which
+ * it may not expand again. Tokens also keep the blanks that preceded them
+ * so the expanded line is spaced like its source. Hide-sets are lists
+ * sharing their tails with 0 as the empty set. Everything else a line
+ * needs, token lists, arguments and text of tokens made by # and ##, is
+ * scratch taken from an arena that is emptied when the line is done. */
+struct zcc_xtok {
+    struct token tok;
+    const char* gap;
+    unsigned int gaplen;
+    unsigned int hide;
+};
+
+struct zcc_hide {
+    size_t macro;
+    unsigned int next;
+};
+
+/* Blocks of the arena are kept from line to line. Allocations bump an
+ * offset into the current block, the last one may grow in place. */
+#ifndef ZCC_ARENA_BLOCK
+#define ZCC_ARENA_BLOCK 0x10000
+#endif
 
-    zmacro_t* macro;
-    struct token* toks = tokens->data, *body;
-    const size_t count = tokens->size;
+#define ZCC_ARENA_ALIGN (2 * sizeof(void*))
+#define zcc_arena_round(n) (((n) + ZCC_ARENA_ALIGN - 1) & ~(ZCC_ARENA_ALIGN - 1))
 
-    struct vector subtoks, args, *argstrs;
-    struct string s, subst, line = string_empty();
-    
-    zassert(refs);
-    for (refcount = 0; refs[refcount]; ++refcount);
+struct zcc_block {
+    char* data;
+    size_t size;
+};
 
-    perm = refcount ? ((long)refs[refcount - 1] == -1) : 0;
-    if (perm) {
-        refs[--refcount] = 0;
-    }
-    
-    for (i = 0; i < count; ++i) {
-        if (refcount && i + 2 < count && toks[i + 1].str[0] == '#' && toks[i + 1].str[1] == '#') {
-            struct string s = zcc_concatenate(toks[i], toks[i + 2]);
-            string_remove_trail(&line);
-            string_concat(&line, &s);
-            string_free(&s);
-            i += 2;
-            goto zlexspace;
-        }
+struct zcc_arena {
+    struct vector blocks;
+    size_t block;
+    size_t used;
+    void* last;
+};
 
-        if (!_isid(*toks[i].str)) {
-            goto zlextok;
-        }
+struct zcc_expansion {
+    const struct zmacros* defines;
+    struct vector hides;
+    struct zcc_arena arena;
+};
 
-        find = zcc_map_search(defines, toks[i]);
-        if (!find) {
-            goto zlextok;
-        }
+static struct zcc_expansion zcc_x;
 
-        for (j = 0; !perm && j < refcount; ++j) {
-            if (find == refs[j]) {
-                goto zlextok;
-            }
+static void* zcc_arena_alloc(struct zcc_arena* arena, size_t size)
+{
+    struct zcc_block* b = arena->blocks.size ? (struct zcc_block*)arena->blocks.data + arena->block : NULL;
+    
+    size = zcc_arena_round(size);
+    while (!b || b->size - arena->used < size) {
+        if (b && arena->block + 1 < arena->blocks.size) {
+            ++arena->block;
         }
-
-        macro = map_value_at(defines, find - 1);
-        if (!macro->str.data) {
-            continue;
+        else {
+            struct zcc_block block;
+            block.size = size > ZCC_ARENA_BLOCK ? size : ZCC_ARENA_BLOCK;
+            block.data = zmalloc(block.size);
+            vector_push(&arena->blocks, &block);
+            arena->block = arena->blocks.size - 1;
         }
+        b = (struct zcc_block*)arena->blocks.data + arena->block;
+        arena->used = 0;
+    }
 
-        if (*macro->str.data != '(') {
-            struct string sub;
-            refs[refcount++] = find;
-            sub = zcc_expand(&macro->body, defines, refs, linecount);
-            if (!perm) {
-                refs[--refcount] = 0;
-            }
-            string_concat(&line, &sub);
-            string_free(&sub);
-            goto zlexspace;
-        }
+    arena->last = b->data + arena->used;
+    arena->used += size;
+    return arena->last;
+}
 
-        if (i + 1 == count || *toks[i + 1].str != '(') {
-            zcc_log("zcc warning: Macro function call must include parenthesis at line %zu.\n", linecount);
-            goto zlextok;
-        }
-        ++i;
-        
-        close = zcc_lexparen(toks[i].str);
-        if (!close) {
-            zcc_log("Macro function call must close parenthesis at line '%zu'.\n", linecount);
-            string_free(&line);
-            return line;
-        }
-        
-        args = vector_create(sizeof(struct vector));
+static void zcc_arena_reset(struct zcc_arena* arena)
+{
+    arena->block = 0;
+    arena->used = 0;
+    arena->last = NULL;
+}
 
-        j = ++i;
-        while (j < count && toks[j].str + toks[j].len < close) {
-            int n;
+static struct vector zcc_scratch(const size_t bytes)
+{
+    struct vector v;
+    v.data = NULL;
+    v.bytes = bytes;
+    v.capacity = 0;
+    v.size = 0;
+    return v;
+}
 
-            if (_isparen(*toks[j].str)) {
-                close = zcc_lexparen(toks[j].str);
-                while (j < count && toks[j].str < close) {
-                    ++j;
-                }
-            }
+/* Appends count elements to a vector held in the arena */
+static void zcc_scratch_push(struct vector* v, const void* data, const size_t count)
+{
+    struct zcc_arena* arena = &zcc_x.arena;
+    if (!count) {
+        return;
+    }
 
-            n = (toks[j].str < close && j + 1 < count && toks[j + 1].str + toks[j + 1].len >= close);
-            if (*toks[j].str == ',' || toks[j].str >= close || j + 1 >= count || n) {
-                struct vector arg = vector_wrap_sized(toks + i, j + n - i, sizeof(struct token));
-                vector_push(&args, &arg);
-                j += n;
-                i = j + 1;
-            }
-            ++j;
+    if (v->size + count > v->capacity) {
+        size_t capacity = v->capacity ? v->capacity * 2 : 0x10;
+        const struct zcc_block* b = (struct zcc_block*)arena->blocks.data + arena->block;
+        while (capacity < v->size + count) {
+            capacity *= 2;
         }
-        i -= !!args.size;
-
 
-        if (args.size != macro->args.size) {
-            struct token t = ztok_get("__VA_ARGS__");
-            found = zcc_macro_search(&macro->args, t);
-            if (found) {
-                struct vector* argarr = args.data;
-                while (found < args.size) {
-                    const size_t size = (size_t)((char*)argarr[found].data - (char*)argarr[found - 1].data + argarr[found].size * argarr[found].bytes) / argarr[found].bytes;
-                    argarr[found - 1].size = size;
-                    argarr[found - 1].capacity = size;
-                    vector_remove(&args, found);
-                }
-            }
-            else {
-                zcc_log("Macro function call has different number of arguments at line %zu.\n", linecount);
-                string_free(&line);
-                break;
-            }
+        if (v->data && v->data == arena->last && (char*)v->data + capacity * v->bytes <= b->data + b->size) {
+            arena->used = (char*)v->data - b->data + zcc_arena_round(capacity * v->bytes);
         }
-        
-        bcount = macro->body.size;
-        body = macro->body.data;
-        argstrs = args.data;
-        
-        subst = string_empty();
-        for (j = 0; j < bcount; ++j) {
-            if (j + 2 < bcount && *body[j + 1].str == '#' && body[j + 1].str[1] == '#') {
-                size_t n;
-                for (n = j + 2; j <= n; j += 2) {
-                    found = zcc_macro_search(&macro->args, body[j]);
-                    if (found--) {
-                        struct token* a = argstrs[found].data;
-                        struct token b = a[argstrs[found].size - 1];
-                        string_push(&subst, zstrbuf(a[0].str, b.str + b.len - a[0].str));
-                    }
-                    else string_push_tok(&subst, body[j]);
-                }
-            }
-            else if (j + 1 < bcount && *body[j].str == '#' && body[j].str[1] != '#') {
-                found = zcc_macro_search(&macro->args, body[j + 1]);
-                if (!found--) {
-                    zcc_log("zcc error: '#' macro operator is not followed by macro parameter at line %zu.\n", linecount);
-                    string_push_tok(&subst, body[j++]);
-                    string_push_tok(&subst, body[j]);
-                    continue;
-                }
-                s = zcc_stringify(argstrs + found);
-                string_concat(&subst, &s);
-                string_free(&s);
-                ++j;
-            }
-            else {
-                found = zcc_macro_search(&macro->args, body[j]);
-                if (found--) {
-                    refs[refcount] = -1;
-                    s = zcc_expand(argstrs + found, defines, refs, linecount);
-                    for (refcount = 0; refs[refcount]; ++refcount);
-                    string_concat(&subst, &s);
-                    string_free(&s);
-                }
-                else string_push_tok(&subst, body[j]);
-            }
-            
-            if (j + 1 < bcount && body[j + 1].str > body[j].str + body[j].len) {
-                string_push(&subst, " ");
+        else {
+            void* data = zcc_arena_alloc(arena, capacity * v->bytes);
+            if (v->size) {
+                zmemcpy(data, v->data, v->size * v->bytes);
             }
+            v->data = data;
         }
-        
-        subtoks = zcc_tokenize_line(subst.data);
-        refs[refcount++] = find;
-        s = zcc_expand(&subtoks, defines, refs, linecount);
-        if (!perm) {
-            refs[--refcount] = 0;
-        }
+        v->capacity = capacity;
+    }
 
-        string_concat(&line, &s);
-        
-        string_free(&s);
-        string_free(&subst);
-        vector_free(&subtoks);
-        vector_free(&args);
-        
-        goto zlexspace;
+    zmemcpy((char*)v->data + v->size * v->bytes, data, count * v->bytes);
+    v->size += count;
+}
 
-zlextok:
-        
-        string_push_tok(&line, toks[i]);
-        
-zlexspace:
-        if (i + 1 < count) {
-            string_push_space(&line, toks[i], toks[i + 1].str);
-        }
+/* Expansion input is a stack read from its back */
+static void zcc_scratch_reverse(struct vector* v)
+{
+    size_t i;
+    struct zcc_xtok t, *toks = v->data;
+    for (i = 0; i < v->size / 2; ++i) {
+        t = toks[i];
+        toks[i] = toks[v->size - 1 - i];
+        toks[v->size - 1 - i] = t;
     }
-    return line;
 }
 
-static struct string zcc_expand_line(const struct vector* tokens, const struct map* defines, const size_t linecount)
+static int zcc_hide_has(const struct zcc_expansion* x, unsigned int hide, const size_t macro)
 {
-    size_t refs[0xfff] = {0};
-    struct string s = zcc_expand(tokens, defines, refs, linecount);
-    return s;
+    const struct zcc_hide* h = x->hides.data;
+    for (; hide; hide = h[hide].next) {
+        if (h[hide].macro == macro) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-static struct string zcc_ifdef_preexpand(const struct map* defines, struct token tok, const size_t linecount)
+static unsigned int zcc_hide_add(struct zcc_expansion* x, const unsigned int hide, const size_t macro)
 {
-    static const char ifdef[] = "ifdef", ifndef[] = "ifndef", defined[] = "defined";
-    
-    size_t find;
-    struct string s = string_ranged(tok.str, zcc_lexline(tok.str));
+    struct zcc_hide h;
+    if (zcc_hide_has(x, hide, macro)) {
+        return hide;
+    }
+
+    h.macro = macro;
+    h.next = hide;
+    vector_push(&x->hides, &h);
+    return (unsigned int)x->hides.size - 1;
+}
 
-    if (!zmemcmp(s.data, ifdef, sizeof(ifdef) - 1)) {
-        string_remove_range(&s, 0, sizeof(ifdef) - 1);
-        string_push_at(&s, "if defined", 0);
+static unsigned int zcc_hide_union(struct zcc_expansion* x, unsigned int a, unsigned int b)
+{
+    /* most tokens of a body have no hide-set of their own */
+    if (!a || a == b) {
+        return b;
     }
-    else if (!zmemcmp(s.data, ifndef, sizeof(ifndef) - 1)) {
-        string_remove_range(&s, 0, sizeof(ifndef) - 1);
-        string_push_at(&s, "if !defined", 0);
+    for (; b; b = ((struct zcc_hide*)x->hides.data)[b].next) {
+        a = zcc_hide_add(x, a, ((struct zcc_hide*)x->hides.data)[b].macro);
     }
+    return a;
+}
 
-    tok = ztok_get(s.data);
-    tok = ztok_nextl(tok);
-    while (tok.str) {
-        if (*tok.str == '\'') {
-            int n = tok.str[1 + (tok.str[1] == '\\')];
-            n = zitoa(n, (char*)(size_t)tok.str, 10);
-            tok.len = n;
-            string_remove_range(&s, tok.str + n - s.data, tok.str + tok.len - s.data);
-        }
-        else if (_isid(*tok.str)) {
-            if (!zmemcmp(tok.str, defined, sizeof(defined) - 1)) {
-                char* c;
-                string_remove_range(&s, tok.str - s.data, tok.str + tok.len - s.data);
-                tok = ztok_get(tok.str);
-                if (*tok.str == '(') {
-                    tok = ztok_nextl(tok);
-                }
-                find = zcc_map_search(defines, tok);
-                string_remove_range(&s, tok.str + 1 - s.data, tok.str + tok.len - s.data);
-                c = (char*)(size_t)tok.str;
-                *c = !!find + '0';
-                tok.len = 1;
-            }
-            else {
-                find = zcc_map_search(defines, tok);
-                if (find) {
-                    const char* close;
-                    zmacro_t* m = map_value_at(defines, find - 1);
-
-                    if (*m->str.data == '(') {
-                        tok = ztok_nextl(tok);
-                        if (!tok.str || *tok.str != '(') {
-                            continue;
-                        }
-                        
-                        close = zcc_lexparen(tok.str) - 1;
-                        if (!close) {
-                            zcc_log("Macro function call in #if line does not close parenthesis at line %zu\n", linecount);
-                            continue;
-                        }
-                        tok = ztok_get(close);
-                    }
-                }
-                else {
-                    char* c;
-                    string_remove_range(&s, tok.str + 1 - s.data, tok.str + tok.len - s.data);
-                    c = (char*)(size_t)tok.str;
-                    *c = '0';
-                    tok.len = 1;
-                }
-            }
+static unsigned int zcc_hide_intersect(struct zcc_expansion* x, unsigned int a, const unsigned int b)
+{
+    unsigned int hide = 0;
+    for (; a; a = ((struct zcc_hide*)x->hides.data)[a].next) {
+        const size_t macro = ((struct zcc_hide*)x->hides.data)[a].macro;
+        if (zcc_hide_has(x, b, macro)) {
+            hide = zcc_hide_add(x, hide, macro);
         }
-
-        tok = ztok_nextl(tok);
     }
+    return hide;
+}
 
-    return s;
+/* Token lexed from text in the arena, which is NUL terminated here */
+static struct token zcc_xtok_text(struct vector* text)
+{
+    zcc_scratch_push(text, "", 1);
+    return ztok_get(text->data);
 }
 
-static long zcc_ifdef_solve(const struct map* defines, struct token tok, size_t linecount)
+static struct token zcc_stringify(const struct zcc_xtok* toks, const size_t count)
 {
-    long n;
-    struct vector a;
-    struct string s, tmp = zcc_ifdef_preexpand(defines, tok, linecount);
+    size_t i, j;
+    struct vector str = zcc_scratch(1);
+    zcc_scratch_push(&str, "\"", 1);
+    for (i = 0; i < count; ++i) {
+        const struct token tok = toks[i].tok;
+        if (i && toks[i].gaplen) {
+            zcc_scratch_push(&str, " ", 1);
+        }
 
-    a = zcc_tokenize_line(tmp.data);
-    vector_remove(&a, 0);
+        if (*tok.str != '"' && *tok.str != '\'') {
+            zcc_scratch_push(&str, tok.str, tok.len);
+            continue;
+        }
 
-    s = zcc_expand_line(&a, defines, linecount);
-    n = zsolve_stack(s.data);
-    
-    vector_free(&a);
-    string_free(&tmp);
-    string_free(&s);
-    return n;
+        /* literals keep their quotes and backslashes escaped */
+        for (j = 0; j < tok.len; ++j) {
+            if (tok.str[j] == '"' || tok.str[j] == '\\') {
+                zcc_scratch_push(&str, "\\", 1);
+            }
+            zcc_scratch_push(&str, tok.str + j, 1);
+        }
+    }
+    zcc_scratch_push(&str, "\"", 1);
+    return zcc_xtok_text(&str);
 }
 
-static struct string zcc_ifdef(const struct map* defines, char** linestart, size_t linecount)
+/* Joins the last token of out with the one at index rhs. Texts that do
+ * not lex back to a single token are left as two tokens. */
+static void zcc_paste(struct vector* out, const size_t rhs)
 {
-    static const char ifstr[] = "if", elsestr[] = "else", elif[] = "elif", endif[] = "endif";
-
-    size_t scope = 0;
-    char* lend = zcc_lexline(*linestart), *lstart;
-    struct token tok = ztok_nextl(ztok_get(*linestart));
+    struct token tok;
+    struct zcc_xtok* toks = out->data;
+    struct vector text = zcc_scratch(1);
+
+    zcc_scratch_push(&text, toks[rhs - 1].tok.str, toks[rhs - 1].tok.len);
+    zcc_scratch_push(&text, toks[rhs].tok.str, toks[rhs].tok.len);
+    tok = zcc_xtok_text(&text);
+    if (tok.str && tok.len == text.size - 1) {
+        toks[rhs - 1].tok = tok;
+        zmemmove(toks + rhs, toks + rhs + 1, (out->size - rhs - 1) * sizeof(struct zcc_xtok));
+        --out->size;
+    }
+    else {
+        zcc_log_at(NULL);
+        zcc_log("Pasting '%s' does not give a valid token.\n", (char*)text.data);
+    }
+}
 
-    struct string s = string_empty();
-    long n = zcc_ifdef_solve(defines, tok, linecount);
-    long f = !!n;
-    long b = f;
+static void zcc_expand_run(struct zcc_expansion* x, struct vector* in, struct vector* out, const int top);
 
-    lstart = lend + !!*lend;
-    lend = zcc_lexline(lstart);
+/* Argument fully macro expanded on its own, as used by a parameter that
+ * is neither operand of # nor ## */
+static struct vector zcc_expand_arg(struct zcc_expansion* x, const struct zcc_xtok* toks, const size_t count)
+{
+    struct vector in = zcc_scratch(sizeof(struct zcc_xtok));
+    struct vector out = zcc_scratch(sizeof(struct zcc_xtok));
+    zcc_scratch_push(&in, toks, count);
+    zcc_scratch_reverse(&in);
+    zcc_expand_run(x, &in, &out, 0);
+    return out;
+}
 
-    while (*lend) {
-        ++linecount;
+/* Replaces the parameters in the body of the macro invoked by name, adds
+ * hide to every resulting token and pushes them back onto the input.
+ * Arguments are ranges of call, the tokens following the macro name. */
+static void zcc_subst(struct zcc_expansion* x, const zmacro_t* macro, const struct zcc_xtok* name, const struct zcc_xtok* call, const size_t* args, const unsigned int hide, struct vector* in)
+{
+    static const char gap[] = " ";
+    size_t i, j, found, start, lhs = 0;
+    unsigned int prev = 0;
+    int paste = 0;
+    const int fn = *macro->str.data == '(';
+    const struct token* body = macro->body.data;
+    const size_t count = macro->body.size;
+    struct vector* expanded = NULL;
+    struct zcc_xtok* toks, t;
+    struct vector out = zcc_scratch(sizeof(struct zcc_xtok));
+
+    if (macro->args.size) {
+        expanded = zcc_arena_alloc(&x->arena, macro->args.size * sizeof(struct vector));
+        zmemset(expanded, 0, macro->args.size * sizeof(struct vector));
+    }
 
-        tok = ztok_get(lstart);
-        if (!tok.str || *tok.str != '#') {
-            goto zlexifdef;
+    for (j = 0; j < count; ++j) {
+        const int pasted = j + 1 < count && body[j + 1].len == 2 && body[j + 1].str[0] == '#' && body[j + 1].str[1] == '#';
+        if (body[j].len == 2 && body[j].str[0] == '#' && body[j].str[1] == '#') {
+            paste = 1;
+            continue;
         }
 
-        tok = ztok_nextl(tok);
-        if (!zmemcmp(tok.str, elsestr, sizeof(elsestr) - 1) && !scope) {
-            if (!b) {
-                b = 1;
-                f = 1;
-                goto zlexifdefend;
+        start = out.size;
+        t.gap = gap;
+        t.gaplen = j && body[j].str > body[j - 1].str + body[j - 1].len;
+        t.hide = 0;
+        
+        found = fn ? zcc_macro_search(&macro->args, body[j]) : 0;
+        if (fn && body[j].len == 1 && *body[j].str == '#') {
+            found = j + 1 < count ? zcc_macro_search(&macro->args, body[j + 1]) : 0;
+            if (!found--) {
+                zcc_log_at(NULL);
+                zcc_log("zcc error: '#' macro operator is not followed by macro parameter.\n");
+                t.tok = body[j];
+                zcc_scratch_push(&out, &t, 1);
+                continue;
             }
-            f = 0;
+            t.tok = zcc_stringify(call + args[2 * found], args[2 * found + 1] - args[2 * found]);
+            zcc_scratch_push(&out, &t, 1);
+            ++j;
         }
-        else if (!zmemcmp(tok.str, elif, sizeof(elif) - 1) && !scope) {
-            if (!b) {
-                n = zcc_ifdef_solve(defines, tok, linecount);
-                f = !!n;
-                b = f;
-                goto zlexifdefend;
+        else if (found--) {
+            /* operands of ## are not expanded */
+            const struct zcc_xtok* arg = call + args[2 * found];
+            size_t n = args[2 * found + 1] - args[2 * found];
+            if (!paste && !pasted) {
+                if (!expanded[found].data) {
+                    expanded[found] = zcc_expand_arg(x, arg, n);
+                }
+                arg = expanded[found].data;
+                n = expanded[found].size;
             }
-            f = 0;
-        }
-        else if (!zmemcmp(tok.str, endif, sizeof(endif) - 1)) {
-            if (scope) {
-                --scope;
+            zcc_scratch_push(&out, arg, n);
+            if (n) {
+                toks = out.data;
+                toks[start].gap = t.gap;
+                toks[start].gaplen = t.gaplen;
             }
-            else break;
         }
-        else if (!zmemcmp(tok.str, ifstr, sizeof(ifstr) - 1)) {
-            ++scope;
+        else {
+            t.tok = body[j];
+            zcc_scratch_push(&out, &t, 1);
         }
 
-zlexifdef:
-        if (f) {
-            string_push(&s, zstrbuf(lstart, lend - lstart + 1));
+        /* an empty operand leaves the other one as it is */
+        if (paste) {
+            if (start > lhs && out.size > start) {
+                zcc_paste(&out, start);
+                start = out.size - 1;
+            }
+            else if (start > lhs) {
+                start = lhs;
+            }
+            paste = 0;
         }
-zlexifdefend:
-        lstart = lend + !!*lend;
-        lend = zcc_lexline(lstart);
+        lhs = start;
     }
 
-    if (!*lend) {
-        zcc_log("Missing closing #endif directive at line %zu.\n", linecount);
+    /* runs of tokens from one argument share their hide-set */
+    toks = out.data;
+    for (i = 0; i < out.size; ++i) {
+        if (i && toks[i].hide == prev) {
+            toks[i].hide = toks[i - 1].hide;
+            continue;
+        }
+        prev = toks[i].hide;
+        toks[i].hide = zcc_hide_union(x, toks[i].hide, hide);
     }
-
-    *linestart = lstart;
-    return s;
+    if (out.size) {
+        toks[0].gap = name->gap;
+        toks[0].gaplen = name->gaplen;
+    }
+    zcc_scratch_reverse(&out);
+    zcc_scratch_push(in, out.data, out.size);
 }
 
-static char* zcc_preprocess_directive(struct string* text, struct map* defines, const char** includes, char* linestart, size_t linecount)
+static int zmacro_variadic(const zmacro_t* macro)
 {
-    static const char inc[] = "include", def[] = "define", ifdef[] = "if", undef[] = "undef";
-    static const char warning[] = "warning", error[] = "error";
+    static const char vargs[] = "__VA_ARGS__";
+    const struct token* params = macro->args.data;
+    const size_t n = macro->args.size;
+    return n && params[n - 1].len == sizeof(vargs) - 1 && !zmemcmp(params[n - 1].str, vargs, sizeof(vargs) - 1);
+}
 
-    const size_t index = linestart - text->data;
-    const char* lineend = zcc_lexline(linestart);
+/* Pops the arguments of a macro call into call, args gets the bounds of
+ * each one. Returns the index of the closing parenthesis or 0. */
+static size_t zcc_expand_call(const zmacro_t* macro, struct vector* in, struct vector* call, struct vector* args)
+{
+    size_t depth = 0, bound = 0;
+    const int variadic = zmacro_variadic(macro);
 
-    struct token tok = ztok_get(linestart);
-    tok = ztok_nextl(tok);
+    while (in->size) {
+        const struct zcc_xtok* t = vector_peek(in);
+        const char c = t->tok.len == 1 ? *t->tok.str : 0;
+        zcc_scratch_push(call, t, 1);
+        --in->size;
 
-    if (!zmemcmp(tok.str, inc, sizeof(inc) - 1)) {
-        struct token inc = zcc_include(includes, tok, linecount);
-        if (inc.str) {
-            size_t len = (size_t)inc.len;
-            zcc_preprocess_text((char*)(size_t)inc.str, &len);
-            string_push_at(text, inc.str, lineend + 1 - text->data);
-            zfree((char*)(size_t)inc.str);
-            linestart = text->data + index;
-            lineend = zcc_lexline(linestart);
+        if (c == '(' && !depth++) {
+            bound = call->size;
         }
-    }
-    else if (!zmemcmp(tok.str, def, sizeof(def) - 1)) {
-        if (zcc_printdefines) {
-            zcc_log("%s\n", zstrbuf(linestart, lineend - linestart));
+        else if ((c == ')' && !--depth) || (c == ',' && depth == 1 && !(variadic && args->size / 2 + 1 == macro->args.size))) {
+            zcc_scratch_push(args, &bound, 1);
+            bound = call->size - 1;
+            zcc_scratch_push(args, &bound, 1);
+            bound = call->size;
+            if (c == ')') {
+                return call->size - 1;
+            }
         }
-        zcc_define(defines, tok);
-    }
-    else if (!zmemcmp(tok.str, undef, sizeof(undef) - 1)) {
-        zcc_undef(defines, tok, linecount);
-    }
-    else if (!zmemcmp(tok.str, ifdef, sizeof(ifdef) - 1)) {
-        struct string inc = zcc_ifdef(defines, &linestart, linecount);
-        lineend = zcc_lexline(linestart);
-        string_remove_range(text, index, lineend - text->data);
-        string_push_at(text, inc.data, index);
-        string_free(&inc);
-        return text->data + index;
-    }
-    else if (!zmemcmp(tok.str, warning, sizeof(warning) - 1)) {
-        zcc_log("%s", zstrbuf(linestart, lineend - linestart + 1));
-    }
-    else if (!zmemcmp(tok.str, error, sizeof(error) - 1)) {
-        zcc_log("%s", zstrbuf(linestart, lineend - linestart + 1));
-        zexit(Z_EXIT_FAILURE);
-    }
-    else {
-        zcc_log("Illegal macro directive at line %zu.\n%s", linecount, zstrbuf(linestart, lineend - linestart + 1));
-        zexit(Z_EXIT_FAILURE);
     }
+    return 0;
+}
+
+static void zcc_expand_run(struct zcc_expansion* x, struct vector* in, struct vector* out, const int top)
+{
+    size_t find, close, given;
+    struct zcc_xtok t;
+    const zmacro_t* macro;
+    struct vector call, args;
+
+    while (in->size) {
+        t = *(struct zcc_xtok*)vector_peek(in);
+        --in->size;
+
+        find = _isid(*t.tok.str) ? zcc_macro_find(x->defines, t.tok) : 0;
+        if (!find || zcc_hide_has(x, t.hide, find)) {
+            zcc_scratch_push(out, &t, 1);
+            continue;
+        }
+
+        macro = zcc_macro_at(x->defines, find);
+        if (!macro->str.data) {
+            continue;
+        }
+
+        if (*macro->str.data != '(') {
+            zcc_subst(x, macro, &t, NULL, NULL, zcc_hide_add(x, t.hide, find), in);
+            continue;
+        }
+
+        if (!in->size || *((struct zcc_xtok*)vector_peek(in))->tok.str != '(') {
+            if (top) {
+                zcc_log_at(t.tok.str);
+                zcc_log("zcc warning: Macro function call must include parenthesis.\n");
+            }
+            zcc_scratch_push(out, &t, 1);
+            continue;
+        }
+
+        call = zcc_scratch(sizeof(struct zcc_xtok));
+        args = zcc_scratch(sizeof(size_t));
+        close = zcc_expand_call(macro, in, &call, &args);
+        
+        /* F() passes no argument to a macro without parameters */
+        given = args.size / 2;
+        if (given == 1 && !macro->args.size && ((size_t*)args.data)[0] == ((size_t*)args.data)[1]) {
+            given = 0;
+        }
+
+        if (!close) {
+            zcc_log_at(t.tok.str);
+            zcc_log("Macro function call must close parenthesis.\n");
+        }
+        else if (given + 1 == macro->args.size && zmacro_variadic(macro)) {
+            /* the variable arguments may be left out */
+            zcc_scratch_push(&args, &close, 1);
+            zcc_scratch_push(&args, &close, 1);
+        }
+        else if (given != macro->args.size) {
+            zcc_log_at(t.tok.str);
+            zcc_log("Macro function call has different number of arguments.\n");
+            close = 0;
+        }
+
+        if (close) {
+            const struct zcc_xtok* rp = (struct zcc_xtok*)call.data + close;
+            zcc_subst(x, macro, &t, call.data, args.data, zcc_hide_add(x, zcc_hide_intersect(x, t.hide, rp->hide), find), in);
+        }
+        else {
+            zcc_scratch_push(out, &t, 1);
+            zcc_scratch_push(out, call.data, call.size);
+        }
+    }
+}
 
-    string_remove_range(text, index, index + lineend - linestart + 1);
-    return linestart;
+static void zcc_expansion_init(void)
+{
+    struct zcc_hide none = {0, 0};
+    zcc_x.hides = vector_create(sizeof(struct zcc_hide));
+    zcc_x.arena.blocks = vector_create(sizeof(struct zcc_block));
+    zcc_arena_reset(&zcc_x.arena);
+    vector_push(&zcc_x.hides, &none);
 }
 
-static char* zcc_preprocess_expand(struct string* text, const struct map* defines, const char* linestart, size_t linecount)
+static void zcc_expansion_free(void)
 {
+    size_t i;
+    for (i = 0; i < zcc_x.arena.blocks.size; ++i) {
+        zfree(((struct zcc_block*)zcc_x.arena.blocks.data)[i].data);
+    }
+    vector_free(&zcc_x.arena.blocks);
+    vector_free(&zcc_x.hides);
+}
+
+/* Starts the expansion of a line, dropping all of the previous one */
+static struct zcc_expansion* zcc_expansion_begin(const struct zmacros* defines)
+{
+    zcc_x.defines = defines;
+    zcc_x.hides.size = 1;
+    zcc_arena_reset(&zcc_x.arena);
+    return &zcc_x;
+}
+
+/* Expands the tokens of a line from tok on and prints them to out spaced
+ * as in the source */
+static void zcc_expand_line(struct string* out, const struct zmacros* defines, struct token tok)
+{
+    size_t i;
+    struct zcc_xtok t;
+    const struct zcc_xtok* xtoks;
+    struct zcc_expansion* x = zcc_expansion_begin(defines);
+    struct vector in = zcc_scratch(sizeof(struct zcc_xtok));
+    struct vector res = zcc_scratch(sizeof(struct zcc_xtok));
+    const char* end = tok.str;
+
+    t.hide = 0;
+    for (; tok.str; tok = ztok_nextl(tok)) {
+        t.tok = tok;
+        t.gap = end;
+        t.gaplen = (unsigned int)(tok.str - end);
+        end = tokend(tok);
+        zcc_scratch_push(&in, &t, 1);
+    }
+
+    zcc_scratch_reverse(&in);
+    zcc_expand_run(x, &in, &res, 1);
+
+    xtoks = res.data;
+    for (i = 0; i < res.size; ++i) {
+        if (i) {
+            string_push_sized(out, xtoks[i].gap, xtoks[i].gaplen);
+        }
+        string_push_sized(out, xtoks[i].tok.str, xtoks[i].tok.len);
+    }
+}
+
+/* #if expressions are evaluated on the expanded tokens by precedence
+ * climbing. Values are the widest integers there are, long and unsigned
+ * long in C89, kept as unsigned long with a flag telling which one they
+ * are so arithmetic wraps instead of overflowing. Operands that are not
+ * evaluated, past && || and ?:, are parsed with live unset and may not
+ * fail. Identifiers left after expansion are 0. */
+struct zcc_value {
+    unsigned long v;
+    int u;
+};
+
+struct zcc_eval {
+    const struct zcc_xtok* toks;
+    size_t size;
+    size_t pos;
+    const char* bad;
+};
+
+#define ZCC_LONG_MAX (~0UL >> 1)
+#define ZCC_LONG_BITS (sizeof(unsigned long) * 8)
+
+static int zcc_eval_prec(const unsigned int kind)
+{
+    switch (kind) {
+        case ZKIND_QUESTION: return 1;
+        case ZKIND_LOR: return 2;
+        case ZKIND_LAND: return 3;
+        case ZKIND_OR: return 4;
+        case ZKIND_XOR: return 5;
+        case ZKIND_AMP: return 6;
+        case ZKIND_EQ: case ZKIND_NE: return 7;
+        case ZKIND_LT: case ZKIND_GT: case ZKIND_LE: case ZKIND_GE: return 8;
+        case ZKIND_SHL: case ZKIND_SHR: return 9;
+        case ZKIND_PLUS: case ZKIND_MINUS: return 10;
+        case ZKIND_STAR: case ZKIND_SLASH: case ZKIND_PERCENT: return 11;
+    }
+    return 0;
+}
+
+/* Kind of the next token, ZKIND_NULL past the end. Only the first error
+ * is kept. */
+static unsigned int zcc_eval_peek(const struct zcc_eval* e)
+{
+    return e->pos < e->size && !e->bad ? e->toks[e->pos].tok.kind : ZKIND_NULL;
+}
+
+static void zcc_eval_fail(struct zcc_eval* e, const char* msg)
+{
+    if (!e->bad) {
+        e->bad = msg;
+    }
+}
+
+static int zcc_eval_expect(struct zcc_eval* e, const unsigned int kind)
+{
+    if (zcc_eval_peek(e) != kind) {
+        zcc_eval_fail(e, kind == ZKIND_RPAREN ? "missing ')'" : "missing ':'");
+        return 0;
+    }
+    ++e->pos;
+    return 1;
+}
+
+static struct zcc_value zcc_eval_expr(struct zcc_eval* e, const int min, const int live);
+
+static struct zcc_value zcc_eval_unary(struct zcc_eval* e, const int live)
+{
+    struct zlit lit;
     struct token tok;
-    size_t refs[0xfff] = {0}, n;
-    const size_t index = linestart - text->data;
-    struct vector linetoks;
-    struct string l;
-    const char* lineend = zcc_lexline(linestart);
+    struct zcc_value val = {0, 0};
+    const unsigned int kind = zcc_eval_peek(e);
+
+    if (kind == ZKIND_NULL) {
+        zcc_eval_fail(e, "missing operand");
+        return val;
+    }
+
+    tok = e->toks[e->pos++].tok;
+    switch (kind) {
+        case ZKIND_NUM:
+        case ZKIND_CHR: {
+            lit = ztokval(&tok);
+            if (lit.type == ZLIT_CHAR) {
+                val.v = (unsigned long)lit.val.i;
+            }
+            else if (lit.type == ZLIT_INT) {
+                val.v = lit.val.u;
+                val.u = (lit.flags & ZLIT_UNSIGNED) || val.v > ZCC_LONG_MAX;
+            }
+            else zcc_eval_fail(e, "not an integer constant");
+            return val;
+        }
+        case ZKIND_LPAREN: {
+            val = zcc_eval_expr(e, 1, live);
+            zcc_eval_expect(e, ZKIND_RPAREN);
+            return val;
+        }
+        case ZKIND_PLUS: return zcc_eval_unary(e, live);
+        case ZKIND_MINUS: {
+            val = zcc_eval_unary(e, live);
+            val.v = 0UL - val.v;
+            return val;
+        }
+        case ZKIND_TILDE: {
+            val = zcc_eval_unary(e, live);
+            val.v = ~val.v;
+            return val;
+        }
+        case ZKIND_NOT: {
+            val = zcc_eval_unary(e, live);
+            val.v = !val.v;
+            val.u = 0;
+            return val;
+        }
+    }
+
+    if (!_isid(*tok.str)) {
+        --e->pos;
+        zcc_eval_fail(e, "unexpected token");
+    }
+    return val;
+}
+
+static struct zcc_value zcc_eval_binary(struct zcc_eval* e, const unsigned int kind, struct zcc_value l, const struct zcc_value r, const int live)
+{
+    const int u = l.u || r.u;
+    const long sl = (long)l.v, sr = (long)r.v;
+
+    switch (kind) {
+        case ZKIND_STAR: l.v *= r.v; break;
+        case ZKIND_PLUS: l.v += r.v; break;
+        case ZKIND_MINUS: l.v -= r.v; break;
+        case ZKIND_AMP: l.v &= r.v; break;
+        case ZKIND_XOR: l.v ^= r.v; break;
+        case ZKIND_OR: l.v |= r.v; break;
+        case ZKIND_SLASH:
+        case ZKIND_PERCENT: {
+            if (!r.v) {
+                if (live) {
+                    zcc_eval_fail(e, "division by zero");
+                }
+                l.v = 0;
+            }
+            else if (u) {
+                l.v = kind == ZKIND_SLASH ? l.v / r.v : l.v % r.v;
+            }
+            /* the most negative long over -1 does not fit */
+            else if (sr == -1) {
+                l.v = kind == ZKIND_SLASH ? 0UL - l.v : 0;
+            }
+            else l.v = (unsigned long)(kind == ZKIND_SLASH ? sl / sr : sl % sr);
+            l.u = u;
+            return l;
+        }
+        case ZKIND_SHL:
+        case ZKIND_SHR: {
+            /* shifts keep the type of their left operand */
+            if (r.v >= ZCC_LONG_BITS) {
+                l.v = kind == ZKIND_SHR && !l.u && sl < 0 ? ~0UL : 0;
+            }
+            else if (kind == ZKIND_SHL) {
+                l.v <<= r.v;
+            }
+            else l.v = l.u ? l.v >> r.v : (unsigned long)(sl >> r.v);
+            return l;
+        }
+        case ZKIND_EQ: l.v = l.v == r.v; l.u = 0; return l;
+        case ZKIND_NE: l.v = l.v != r.v; l.u = 0; return l;
+        case ZKIND_LT: l.v = u ? l.v < r.v : sl < sr; l.u = 0; return l;
+        case ZKIND_GT: l.v = u ? l.v > r.v : sl > sr; l.u = 0; return l;
+        case ZKIND_LE: l.v = u ? l.v <= r.v : sl <= sr; l.u = 0; return l;
+        case ZKIND_GE: l.v = u ? l.v >= r.v : sl >= sr; l.u = 0; return l;
+    }
+    l.u = u;
+    return l;
+}
+
+static struct zcc_value zcc_eval_expr(struct zcc_eval* e, const int min, const int live)
+{
+    int prec;
+    unsigned int kind;
+    struct zcc_value r, m, l = zcc_eval_unary(e, live);
+
+    while ((prec = zcc_eval_prec(kind = zcc_eval_peek(e))) && prec >= min) {
+        ++e->pos;
+        switch (kind) {
+            case ZKIND_QUESTION: {
+                m = zcc_eval_expr(e, 1, live && l.v);
+                zcc_eval_expect(e, ZKIND_COLON);
+                r = zcc_eval_expr(e, prec, live && !l.v);
+                m.v = l.v ? m.v : r.v;
+                m.u = m.u || r.u;
+                l = m;
+                break;
+            }
+            case ZKIND_LAND: {
+                r = zcc_eval_expr(e, prec + 1, live && l.v);
+                l.v = l.v && r.v;
+                l.u = 0;
+                break;
+            }
+            case ZKIND_LOR: {
+                r = zcc_eval_expr(e, prec + 1, live && !l.v);
+                l.v = l.v || r.v;
+                l.u = 0;
+                break;
+            }
+            default: {
+                r = zcc_eval_expr(e, prec + 1, live);
+                l = zcc_eval_binary(e, kind, l, r, live);
+            }
+        }
+    }
+    return l;
+}
+
+/* Replaces each defined X and defined(X) by 0 or 1, macro expands the rest
+ * and evaluates it */
+static int zcc_if_solve(const struct zmacros* defines, struct token tok)
+{
+    static const char defined[] = "defined";
+
+    struct zcc_xtok t;
+    struct zcc_eval e;
+    struct zcc_value val;
+    struct zcc_expansion* x = zcc_expansion_begin(defines);
+    struct vector in = zcc_scratch(sizeof(struct zcc_xtok));
+    struct vector out = zcc_scratch(sizeof(struct zcc_xtok));
+    const char* end = tokend(tok);
+    const char* at = tok.str;
+
+    t.hide = 0;
+    for (tok = ztok_nextl(tok); tok.str; tok = ztok_nextl(tok)) {
+        t.gap = end;
+        t.gaplen = (unsigned int)(tok.str - end);
+        t.tok = tok;
+        if (tok.len == sizeof(defined) - 1 && !zmemcmp(tok.str, defined, tok.len)) {
+            struct token name = ztok_nextl(tok);
+            const int paren = name.str && *name.str == '(';
+            tok = name = paren ? ztok_nextl(name) : name;
+            if (paren && tok.str) {
+                tok = ztok_nextl(tok);
+            }
+            if (!name.str || !_isid(*name.str) || (paren && (!tok.str || *tok.str != ')'))) {
+                zcc_log_at(tok.str ? tok.str : at);
+                zcc_log("Operator defined requires an identifier.\n");
+                return 0;
+            }
+            t.tok.str = zcc_macro_find(defines, name) ? "1" : "0";
+            t.tok.len = 1;
+            t.tok.type = ZTOK_NUM;
+            t.tok.kind = ZKIND_NUM;
+            t.tok.atom = 0;
+        }
+        end = tokend(tok);
+        zcc_scratch_push(&in, &t, 1);
+    }
+
+    zcc_scratch_reverse(&in);
+    zcc_expand_run(x, &in, &out, 1);
+
+    e.toks = out.data;
+    e.size = out.size;
+    e.pos = 0;
+    e.bad = NULL;
+    val = zcc_eval_expr(&e, 1, 1);
+    if (!e.bad && e.pos < e.size) {
+        zcc_eval_fail(&e, "unexpected token");
+    }
+
+    if (e.bad) {
+        zcc_log_at(e.pos < e.size ? e.toks[e.pos].tok.str : at);
+        zcc_log("Invalid #if expression, %s.\n", e.bad);
+        return 0;
+    }
+    return !!val.v;
+}
+
+/* Whether the group after #if, #ifdef, #ifndef or #elif is kept */
+static int zcc_ifdef_solve(const struct zmacros* defines, struct token tok)
+{
+    static const char ifdef[] = "ifdef", ifndef[] = "ifndef";
+
+    const int def = tok.len == sizeof(ifdef) - 1 && !zmemcmp(tok.str, ifdef, tok.len);
+    const int ndef = tok.len == sizeof(ifndef) - 1 && !zmemcmp(tok.str, ifndef, tok.len);
+    struct token name;
+
+    if (!def && !ndef) {
+        return zcc_if_solve(defines, tok);
+    }
+
+    name = ztok_nextl(tok);
+    if (!name.str || !_isid(*name.str)) {
+        zcc_log_at(name.str ? name.str : tok.str);
+        zcc_log("Macro directive #%s requires an identifier.\n", def ? ifdef : ifndef);
+        return 0;
+    }
+    return !!zcc_macro_find(defines, name) != ndef;
+}
+
+/* Skips the lines of an inactive group without lexing them. Only lines
+ * starting with '#' are looked at, to follow the nesting of conditionals.
+ * Returns the start of the #elif, #else or #endif line ending the group,
+ * only #endif when the chain already kept a group, or the end of text. */
+static const char* zcc_skip_group(const char* str, const int toendif)
+{
+    size_t depth = 0;
+    const char* line, *p;
+
+    for (line = str; *line; line = p + !!*p) {
+        for (p = line; *p == ' ' || *p == '\t'; ++p);
+        if (*p == '#') {
+            for (++p; *p == ' ' || *p == '\t'; ++p);
+            switch (*p) {
+                case 'i': {
+                    depth += p[1] == 'f';
+                    break;
+                }
+                case 'e': {
+                    if (!zmemcmp(p, "endif", 5)) {
+                        if (!depth) {
+                            return line;
+                        }
+                        --depth;
+                    }
+                    else if (!depth && !toendif && p[1] == 'l' && (p[2] == 's' || p[2] == 'i')) {
+                        return line;
+                    }
+                }
+            }
+        }
+        p = zcc_lexline(p);
+    }
+    return line;
+}
+
+/* Including a header again expands to nothing when it was marked with
+ * #pragma once in this translation unit or its guard macro is defined */
+static int zcc_include_skip(const struct zmacros* defines, const struct zheader* header)
+{
+    struct token guard;
+    if (header->once == zcc_src.unit || header->prefix) {
+        return 1;
+    }
+
+    if (!header->guard) {
+        return 0;
+    }
     
-    linetoks = zcc_tokenize_line(linestart);
-    l = zcc_expand(&linetoks, defines, refs, linecount);
+    guard.str = zatom_str(header->guard);
+    guard.len = (unsigned int)zatom_len(header->guard);
+    guard.type = ZTOK_ID;
+    guard.kind = ZKIND_NULL;
+    guard.atom = header->guard;
+    return !!zcc_macro_find(defines, guard);
+}
+
+/* Only #pragma once is understood, other pragmas are dropped */
+static void zcc_pragma(struct token tok)
+{
+    static const char once[] = "once";
+    tok = ztok_nextl(tok);
+    if (!tok.str || tok.len != sizeof(once) - 1 || zmemcmp(tok.str, once, tok.len)) {
+        return;
+    }
 
-    tok = ztok_get(linestart);
-    n = tok.str - text->data;
-    string_remove_range(text, n, n + lineend - tok.str);
+    if (zcc_src.in->header) {
+        zcc_src.in->header->once = zcc_src.unit;
+    }
+}
+
+/* Opens, switches or closes a conditional. A group that is not kept is
+ * skipped up to the directive ending it, a kept one is read on in place. */
+static void zcc_conditional(struct string* out, const struct zmacros* defines, struct token tok)
+{
+    static const char ifstr[] = "if", elif[] = "elif", elsestr[] = "else";
     
-    string_push_at(text, l.data, n);
-    vector_free(&linetoks);
-    string_free(&l);
-    return text->data + index;
+    struct zcc_cond* cond = zcc_src.conds.size ? vector_peek(&zcc_src.conds) : NULL;
+    if (cond && cond->input != zcc_src.inputs.size) {
+        cond = NULL;
+    }
+
+    if (!zmemcmp(tok.str, ifstr, sizeof(ifstr) - 1)) {
+        struct zcc_cond c;
+        c.line = zcc_src.line;
+        c.input = zcc_src.inputs.size;
+        c.taken = !!zcc_ifdef_solve(defines, tok);
+        vector_push(&zcc_src.conds, &c);
+        if (!c.taken) {
+            zcc_src.in->cur = zcc_skip_group(zcc_src.in->cur, 0);
+        }
+        return;
+    }
+
+    if (!cond) {
+        zcc_log_at(tok.str);
+        zcc_log("Macro directive #%s without #if.\n", zstrbuf(tok.str, tok.len));
+        return;
+    }
+
+    if (!zmemcmp(tok.str, elif, sizeof(elif) - 1) || !zmemcmp(tok.str, elsestr, sizeof(elsestr) - 1)) {
+        if (!cond->taken) {
+            cond->taken = tok.str[2] == 's' || !!zcc_ifdef_solve(defines, tok);
+            if (!cond->taken) {
+                zcc_src.in->cur = zcc_skip_group(zcc_src.in->cur, 0);
+            }
+        }
+        else zcc_src.in->cur = zcc_skip_group(zcc_src.in->cur, 1);
+        return;
+    }
+    
+    /* the newline ending #endif is left as an empty line */
+    string_push_sized(out, "\n", 1);
+    --zcc_src.conds.size;
 }
 
-char* zcc_preprocess_macros(char* src, size_t* size, const struct map* defs, const char** includes)
+static void zcc_preprocess_directive(struct string* out, struct zmacros* defines, const char* linestart)
 {
-    struct token tok;
-    size_t linecount = 0;
-    char* linestart, *lineend;
-    const size_t defsize = defs->size;
-    struct string text;
-    struct map defines = map_copy(defs);
-
-    text = string_wrap_sized(src, *size);
-    linestart = text.data;
-    lineend = zcc_lexline(text.data);
- 
-    while (*lineend) {
-        zcc_log(">> %s", zstrbuf(linestart, lineend - linestart + 1));
-        ++linecount;
-        tok = ztok_get(linestart);
+    static const char inc[] = "include", def[] = "define", ifdef[] = "if", undef[] = "undef";
+    static const char warning[] = "warning", error[] = "error", pragma[] = "pragma";
+    static const char elif[] = "elif", elsestr[] = "else", endif[] = "endif";
+
+    const char* lineend = zcc_lexline(linestart);
+    struct token tok = ztok_get(linestart);
+    tok = ztok_nextl(tok);
+
+    if (!zmemcmp(tok.str, inc, sizeof(inc) - 1)) {
+        const char* name = NULL;
+        struct zheader* inc = zcc_include(tok, &name);
+        if (inc && !zcc_include_skip(defines, inc)) {
+            if (zcc_src.headers && inc->unit != zcc_src.unit) {
+                struct zcc_entered entered;
+                entered.header = inc;
+                entered.path = name;
+                vector_push(zcc_src.headers, &entered);
+            }
+            inc->unit = zcc_src.unit;
+
+            /* read next, the directive line itself is dropped */
+            zcc_input_push(inc->file.data, inc->len, zheader_map(inc, name), inc);
+        }
+    }
+    else if (!zmemcmp(tok.str, def, sizeof(def) - 1)) {
+        if (zcc_printdefines) {
+            zcc_log("%s\n", zstrbuf(linestart, lineend - linestart));
+        }
+        zcc_define(defines, tok);
+    }
+    else if (!zmemcmp(tok.str, undef, sizeof(undef) - 1)) {
+        zcc_undef(defines, tok);
+    }
+    else if (!zmemcmp(tok.str, ifdef, sizeof(ifdef) - 1) || !zmemcmp(tok.str, elif, sizeof(elif) - 1)
+            || !zmemcmp(tok.str, elsestr, sizeof(elsestr) - 1) || !zmemcmp(tok.str, endif, sizeof(endif) - 1)) {
+        zcc_conditional(out, defines, tok);
+    }
+    else if (!zmemcmp(tok.str, pragma, sizeof(pragma) - 1)) {
+        zcc_pragma(tok);
+    }
+    else if (!zmemcmp(tok.str, warning, sizeof(warning) - 1)) {
+        zcc_log("%s", zstrbuf(linestart, lineend - linestart + 1));
+    }
+    else if (!zmemcmp(tok.str, error, sizeof(error) - 1)) {
+        zcc_log("%s", zstrbuf(linestart, lineend - linestart + 1));
+        zexit(Z_EXIT_FAILURE);
+    }
+    else {
+        zcc_log_at(linestart);
+        zcc_log("Illegal macro directive.\n%s", zstrbuf(linestart, lineend - linestart + 1));
+        zexit(Z_EXIT_FAILURE);
+    }
+}
+
+static void zcc_preprocess_expand(struct string* out, const struct zmacros* defines, const char* linestart)
+{
+    const char* lineend = zcc_lexline(linestart);
+    const struct token tok = ztok_get(linestart);
+
+    /* leading blanks are kept, the rest of the line is replaced */
+    string_push_sized(out, linestart, tok.str - linestart);
+    zcc_expand_line(out, defines, tok);
+    string_push_sized(out, lineend, !!*lineend);
+}
+
+/* First token of the next line that has one, str moves past that line */
+static struct token zcc_guard_line(const char** str)
+{
+    struct token tok = {NULL, 0, ZTOK_NULL, ZKIND_NULL, 0};
+    const char* lend;
+    while (**str) {
+        tok = ztok_get(*str);
+        lend = zcc_lexline(*str);
+        *str = lend + !!*lend;
         if (tok.str) {
-            if (*tok.str == '#') {
-                linestart = zcc_preprocess_directive(&text, &defines, includes, linestart, linecount);
-                lineend = zcc_lexline(linestart);
-                continue;
-            } else {
-                linestart = zcc_preprocess_expand(&text, &defines, linestart, linecount);
+            return tok;
+        }
+    }
+    return tok;
+}
+
+/* Text that is all one #ifndef X or #if !defined(X) group, with no #else
+ * or #elif of its own, expands to nothing when X is defined */
+unsigned int zcc_preprocess_guard(const char* str)
+{
+    static const char ifstr[] = "if", ifndef[] = "ifndef", defined[] = "defined";
+    static const char elsestr[] = "else", elif[] = "elif", endif[] = "endif";
+
+    int paren;
+    size_t scope = 0;
+    struct token tok = zcc_guard_line(&str), name;
+    if (!tok.str || *tok.str != '#' || !(tok = ztok_nextl(tok)).str) {
+        return 0;
+    }
+
+    if (tok.len == sizeof(ifndef) - 1 && !zmemcmp(tok.str, ifndef, tok.len)) {
+        name = ztok_nextl(tok);
+        tok = name.str ? ztok_nextl(name) : name;
+    }
+    else if (tok.len == sizeof(ifstr) - 1 && !zmemcmp(tok.str, ifstr, tok.len)) {
+        tok = ztok_nextl(tok);
+        if (!tok.str || tok.len != 1 || *tok.str != '!') {
+            return 0;
+        }
+        tok = ztok_nextl(tok);
+        if (!tok.str || tok.len != sizeof(defined) - 1 || zmemcmp(tok.str, defined, tok.len)) {
+            return 0;
+        }
+        name = ztok_nextl(tok);
+        paren = name.str && *name.str == '(';
+        if (paren) {
+            name = ztok_nextl(name);
+        }
+        tok = name.str ? ztok_nextl(name) : name;
+        if (paren) {
+            if (!tok.str || *tok.str != ')') {
+                return 0;
             }
-            lineend = zcc_lexline(linestart);
+            tok = ztok_nextl(tok);
         }
-        linestart = lineend + !!*lineend;
+    }
+    else return 0;
+
+    if (!name.str || name.type != ZTOK_ID || tok.str) {
+        return 0;
+    }
+
+    while ((tok = zcc_guard_line(&str)).str) {
+        if (*tok.str != '#' || !(tok = ztok_nextl(tok)).str) {
+            continue;
+        }
+        
+        if (!zmemcmp(tok.str, endif, sizeof(endif) - 1)) {
+            if (!scope) {
+                break;
+            }
+            --scope;
+        }
+        else if (!zmemcmp(tok.str, ifstr, sizeof(ifstr) - 1)) {
+            ++scope;
+        }
+        else if (!scope && (!zmemcmp(tok.str, elsestr, sizeof(elsestr) - 1) || !zmemcmp(tok.str, elif, sizeof(elif) - 1))) {
+            return 0;
+        }
+    }
+
+    /* nothing may follow the closing #endif */
+    if (!tok.str || zcc_guard_line(&str).str) {
+        return 0;
+    }
+    return zatom_intern(name.str, name.len, zatom_hash(name.str, name.len));
+}
+
+/* Marks of the output map of a precompiled header, name is a string
+ * offset */
+struct zcc_pch_mark {
+    size_t offset;
+    size_t line;
+    size_t name;
+};
+
+/* Text of the precompiled header in use, written ahead of every unit
+ * along with the marks locating it */
+static struct zcc_pch {
+    struct zbuf file;
+    const char* text;
+    size_t size;
+    const struct zcc_pch_mark* marks;
+    size_t markcount;
+    const char* strs;
+} zcc_pch = {{NULL, 0, 0}, NULL, 0, NULL, 0, NULL};
+
+/* Takes over the map locating src and hands back one locating the output.
+ * The headers read are pushed to headers when given. */
+static char* zcc_preprocess_unit(struct zsrcmap* map, const char* src, size_t* size, struct zmacros* defines, const char** includes, struct vector* headers)
+{
+    int remark;
+    size_t i, start;
+    struct token tok;
+    struct zsrcloc loc;
+    const char* linestart, *lineend;
+    struct string out = string_empty();
+
+    out.capacity = zcc_pch.size + *size + 1;
+    out.data = zmalloc(out.capacity);
+    out.data[0] = 0;
+    zcc_src.out = zsrcmap_create(((struct zsrcmark*)map->marks.data)->name);
+    if (zcc_pch.text) {
+        string_push_sized(&out, zcc_pch.text, zcc_pch.size);
+        for (i = 0; i < zcc_pch.markcount; ++i) {
+            loc.name = zsrcmap_name(&zcc_src.out, zcc_pch.strs + zcc_pch.marks[i].name);
+            loc.line = zcc_pch.marks[i].line;
+            loc.column = 1;
+            zsrcmap_mark(&zcc_src.out, zcc_pch.marks[i].offset, loc);
+        }
+    }
+    zcc_src.next = NULL;
+    zcc_src.headers = headers;
+    ++zcc_src.unit;
+    zcc_src.dirs = vector_create(sizeof(unsigned int));
+    for (; *includes; ++includes) {
+        const unsigned int dir = zinclude_dir(*includes, zstrlen(*includes));
+        vector_push(&zcc_src.dirs, &dir);
+    }
+    zcc_src.inputs = vector_create(sizeof(struct zcc_input));
+    zcc_src.conds = vector_create(sizeof(struct zcc_cond));
+    zcc_expansion_init();
+    zcc_input_push(src, *size, *map, NULL);
+
+    while (zcc_src.in) {
+        if (!*zcc_src.in->cur) {
+            zcc_input_pop();
+            continue;
+        }
+
+        linestart = zcc_src.in->cur;
         lineend = zcc_lexline(linestart);
+        zcc_log(">> %s", zstrbuf(linestart, lineend - linestart + !!*lineend));
+        zcc_src.line = linestart - zcc_src.in->data;
+        zcc_src.in->cur = lineend + !!*lineend;
+        remark = zcc_output_remark(linestart);
+        start = out.size;
+
+        tok = ztok_get(linestart);
+        if (!tok.str) {
+            string_push_sized(&out, linestart, lineend - linestart + !!*lineend);
+        }
+        else if (*tok.str == '#') {
+            zcc_preprocess_directive(&out, defines, linestart);
+        }
+        else zcc_preprocess_expand(&out, defines, linestart);
+
+        /* only lines read on in the same input write output */
+        if (out.size > start) {
+            zcc_output_line(remark, start, out.size, linestart, lineend);
+        }
+        else zcc_src.next = NULL;
     }
 
-    zcc_defines_free(&defines, defsize);
-    *size = text.size;
-    return text.data;
+    vector_free(&zcc_src.inputs);
+    vector_free(&zcc_src.conds);
+    zcc_expansion_free();
+    vector_free(&zcc_src.dirs);
+    *map = zcc_src.out;
+    *size = out.size;
+    return out.data;
+}
+
+char* zcc_preprocess_macros(struct zsrcmap* map, const char* src, size_t* size, const struct zmacros* defs, const char** includes)
+{
+    struct zmacros defines = zcc_defines_copy(defs);
+    char* out = zcc_preprocess_unit(map, src, size, &defines, includes, NULL);
+    zcc_defines_free(&defines);
+    return out;
 }
 
-char* zcc_preprocess_text(char* str, size_t* size)
+/* Precompiled headers are written in the layout they are used in once
+ * mapped: a head, the macro records, their token records, the marks of
+ * the text, the headers read under #pragma once or a guard, the strings
+ * they point into and the expanded text. Offsets are from the start of
+ * the file and string offset 0 is an empty string standing for none. */
+
+#define ZCC_PCH_MAGIC "zccpch3"
+
+struct zcc_pch_head {
+    char magic[8];
+    size_t count;
+    size_t macros;
+    size_t toks;
+    size_t marks;
+    size_t markcount;
+    size_t headers;
+    size_t headercount;
+    size_t strs;
+    size_t text;
+    size_t textsize;
+};
+
+/* Headers are found again by path and told to be the same by identity */
+struct zcc_pch_header {
+    unsigned long dev;
+    unsigned long ino;
+    size_t path;
+    size_t guard;
+    size_t once;
+};
+
+struct zcc_pch_macro {
+    size_t name;
+    size_t str;
+    size_t len;
+    size_t args;
+    size_t argc;
+    size_t body;
+    size_t bodyc;
+};
+
+struct zcc_pch_tok {
+    size_t offset;
+    unsigned int len;
+    unsigned short type;
+    unsigned short kind;
+};
+
+static void zcc_pch_toks(struct string* toks, const struct vector* tokens, const char* str)
 {
-    char* ch;
-    size_t linecount = 0, i;
-    struct string text = string_wrap_sized(str, *size);
+    size_t i;
+    struct zcc_pch_tok rec;
+    const struct token* t = tokens->data;
+    for (i = 0; i < tokens->size; ++i) {
+        rec.offset = t[i].str - str;
+        rec.len = t[i].len;
+        rec.type = t[i].type;
+        rec.kind = t[i].kind;
+        string_push_sized(toks, (const char*)&rec, sizeof(rec));
+    }
+}
+
+int zcc_pch_emit(const char* path, struct zsrcmap* map, const char* src, size_t* size, const struct zmacros* defs, const char** includes)
+{
+    int status;
+    size_t i, j;
+    struct zcc_pch_head head;
+    struct zcc_pch_macro rec;
+    struct zcc_pch_mark mark;
+    struct zcc_pch_header hrec;
+    struct string file = string_empty(), macros = string_empty(), marks = string_empty();
+    struct string toks = string_empty(), strs = string_empty(), headers = string_empty();
+    struct vector names, entered = vector_create(sizeof(struct zcc_entered));
+    struct zmacros defines = zcc_defines_copy(defs);
+    char* text = zcc_preprocess_unit(map, src, size, &defines, includes, &entered);
+    const struct zmacro_def* d = zcc_macro_defs(&defines);
+
+    zmemset(&head, 0, sizeof(head));
+    zmemcpy(head.magic, ZCC_PCH_MAGIC, sizeof(ZCC_PCH_MAGIC));
+    string_push_sized(&strs, "", 1);
+    for (i = 0; i < defines.defs.size; ++i) {
+        const zmacro_t* m = &d[i].macro;
+        if (!d[i].atom) {
+            continue;
+        }
+
+        rec.name = strs.size;
+        string_push_sized(&strs, zatom_str(d[i].atom), zatom_len(d[i].atom) + 1);
+        rec.str = 0;
+        rec.len = 0;
+        if (m->str.data) {
+            rec.str = strs.size;
+            rec.len = m->str.size;
+            string_push_sized(&strs, m->str.data, rec.len + 1);
+        }
+        rec.args = toks.size / sizeof(struct zcc_pch_tok);
+        rec.argc = m->args.size;
+        zcc_pch_toks(&toks, &m->args, m->str.data);
+        rec.body = toks.size / sizeof(struct zcc_pch_tok);
+        rec.bodyc = m->body.size;
+        zcc_pch_toks(&toks, &m->body, m->str.data);
+        string_push_sized(&macros, (const char*)&rec, sizeof(rec));
+        ++head.count;
+    }
 
-    for (i = 0; str[i]; ++i) {
-        ch = str + i;
-        switch (*ch) {
+    /* file names are written once, marks find theirs by pointer */
+    names = vector_create(sizeof(size_t));
+    for (i = 0; i < map->names.size; ++i) {
+        const char* name = ((char**)map->names.data)[i];
+        vector_push(&names, &strs.size);
+        string_push_sized(&strs, name, zstrlen(name) + 1);
+    }
+    for (i = 0; i < map->marks.size; ++i) {
+        const struct zsrcmark* m = (struct zsrcmark*)map->marks.data + i;
+        for (j = 0; ((char**)map->names.data)[j] != m->name; ++j);
+        mark.offset = m->offset;
+        mark.line = m->line;
+        mark.name = ((size_t*)names.data)[j];
+        string_push_sized(&marks, (const char*)&mark, sizeof(mark));
+    }
+    head.markcount = map->marks.size;
+
+    /* units using the prefix may not read its headers once more */
+    for (i = 0; i < entered.size; ++i) {
+        const struct zcc_entered* e = (struct zcc_entered*)entered.data + i;
+        if (e->header->once != zcc_src.unit && !e->header->guard) {
+            continue;
+        }
+
+        hrec.dev = e->header->dev;
+        hrec.ino = e->header->ino;
+        hrec.once = e->header->once == zcc_src.unit;
+        hrec.path = strs.size;
+        string_push_sized(&strs, e->path, zstrlen(e->path) + 1);
+        hrec.guard = 0;
+        if (e->header->guard) {
+            hrec.guard = strs.size;
+            string_push_sized(&strs, zatom_str(e->header->guard), zatom_len(e->header->guard) + 1);
+        }
+        string_push_sized(&headers, (const char*)&hrec, sizeof(hrec));
+        ++head.headercount;
+    }
+
+    head.macros = sizeof(head);
+    head.toks = head.macros + macros.size;
+    head.marks = head.toks + toks.size;
+    head.headers = head.marks + marks.size;
+    head.strs = head.headers + headers.size;
+    head.text = head.strs + strs.size;
+    head.textsize = *size;
+    string_push_sized(&file, (const char*)&head, sizeof(head));
+    string_push_sized(&file, macros.data, macros.size);
+    string_push_sized(&file, toks.data, toks.size);
+    string_push_sized(&file, marks.data, marks.size);
+    string_push_sized(&file, headers.data, headers.size);
+    string_push_sized(&file, strs.data, strs.size);
+    string_push_sized(&file, text, *size + 1);
+    status = zcc_fwrite(path, file.data, file.size);
+
+    string_free(&file);
+    string_free(&macros);
+    string_free(&toks);
+    string_free(&marks);
+    string_free(&headers);
+    string_free(&strs);
+    vector_free(&names);
+    vector_free(&entered);
+    zsrcmap_free(map);
+    zcc_defines_free(&defines);
+    zfree(text);
+    return status;
+}
+
+static struct vector zcc_pch_tokens(const struct zcc_pch_tok* recs, const size_t count, const char* str)
+{
+    size_t i;
+    struct token tok;
+    struct vector tokens = vector_create(sizeof(struct token));
+    for (i = 0; i < count; ++i) {
+        tok.str = str + recs[i].offset;
+        tok.len = recs[i].len;
+        tok.type = recs[i].type;
+        tok.kind = recs[i].kind;
+        tok.atom = tok.type == ZTOK_ID ? zatom_get(tok.str, tok.len) : 0;
+        vector_push(&tokens, &tok);
+    }
+    return tokens;
+}
+
+/* Headers the prefix read go into the header cache with its guards, the
+ * ones under #pragma once are skipped from then on. A header found at its
+ * path that is not the same file any more is left alone. */
+static void zcc_pch_headers(const struct zcc_pch_header* recs, const size_t count, const char* strs)
+{
+    size_t i;
+    int fd;
+    struct zheader* header;
+    for (i = 0; i < count; ++i) {
+        const char* path = strs + recs[i].path;
+        if ((fd = zcc_fopen(path)) < 0 || !(header = zheader_open(fd, path))) {
+            continue;
+        }
+        if (header->dev != recs[i].dev || header->ino != recs[i].ino) {
+            continue;
+        }
+
+        if (recs[i].guard && !header->guard) {
+            header->guard = zatom_get(strs + recs[i].guard, zstrlen(strs + recs[i].guard));
+        }
+        header->prefix = !!recs[i].once;
+    }
+}
+
+/* Tells whether count records of size bytes fit between offset and end */
+static int zcc_pch_fits(const size_t offset, const size_t end, const size_t count, const size_t size)
+{
+    return offset <= end && !(offset % sizeof(size_t)) && count <= (end - offset) / size;
+}
+
+/* Checks every section and offset of a precompiled header against the
+ * file before anything is read through them. The strings section ends
+ * with a NUL, so any offset inside it starts a terminated string. */
+static int zcc_pch_check(const struct zbuf* file)
+{
+    size_t i, j, strsize, tokcount;
+    const struct zcc_pch_head* head = (const struct zcc_pch_head*)file->data;
+    const struct zcc_pch_macro* recs;
+    const struct zcc_pch_tok* toks;
+    const struct zcc_pch_mark* marks;
+    const struct zcc_pch_header* headers;
+    const char* strs;
+
+    if (!file->data || file->size < sizeof(*head) || zmemcmp(head->magic, ZCC_PCH_MAGIC, sizeof(ZCC_PCH_MAGIC))) {
+        return 0;
+    }
+    if (head->text > file->size || head->textsize >= file->size - head->text || head->strs >= head->text) {
+        return 0;
+    }
+    if (!zcc_pch_fits(sizeof(*head), head->macros, 0, 1) ||
+        !zcc_pch_fits(head->macros, head->toks, head->count, sizeof(*recs)) ||
+        !zcc_pch_fits(head->toks, head->marks, 0, 1) ||
+        !zcc_pch_fits(head->marks, head->headers, head->markcount, sizeof(*marks)) ||
+        !zcc_pch_fits(head->headers, head->strs, head->headercount, sizeof(*headers))) {
+        return 0;
+    }
+
+    strs = file->data + head->strs;
+    strsize = head->text - head->strs;
+    if (strs[strsize - 1]) {
+        return 0;
+    }
+
+    recs = (const struct zcc_pch_macro*)(file->data + head->macros);
+    toks = (const struct zcc_pch_tok*)(file->data + head->toks);
+    tokcount = (head->marks - head->toks) / sizeof(*toks);
+    for (i = 0; i < head->count; ++i) {
+        if (recs[i].name >= strsize || recs[i].str >= strsize || recs[i].len >= strsize - recs[i].str) {
+            return 0;
+        }
+        if (recs[i].args > tokcount || recs[i].argc > tokcount - recs[i].args ||
+            recs[i].body > tokcount || recs[i].bodyc > tokcount - recs[i].body) {
+            return 0;
+        }
+        for (j = 0; j < recs[i].argc; ++j) {
+            const struct zcc_pch_tok* t = toks + recs[i].args + j;
+            if (t->offset > recs[i].len || t->len > recs[i].len - t->offset) {
+                return 0;
+            }
+        }
+        for (j = 0; j < recs[i].bodyc; ++j) {
+            const struct zcc_pch_tok* t = toks + recs[i].body + j;
+            if (t->offset > recs[i].len || t->len > recs[i].len - t->offset) {
+                return 0;
+            }
+        }
+    }
+
+    marks = (const struct zcc_pch_mark*)(file->data + head->marks);
+    for (i = 0; i < head->markcount; ++i) {
+        if (marks[i].name >= strsize || marks[i].offset > head->textsize) {
+            return 0;
+        }
+    }
+
+    headers = (const struct zcc_pch_header*)(file->data + head->headers);
+    for (i = 0; i < head->headercount; ++i) {
+        if (headers[i].path >= strsize || headers[i].guard >= strsize) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int zcc_pch_load(const char* path, struct zmacros* defines)
+{
+    size_t i;
+    zmacro_t macro;
+    const struct zcc_pch_head* head;
+    const struct zcc_pch_macro* recs;
+    const struct zcc_pch_tok* toks;
+    const char* strs;
+    struct zbuf file = zcc_fmap(path);
+
+    head = (const struct zcc_pch_head*)file.data;
+    if (!zcc_pch_check(&file)) {
+        zcc_log("zcc could not read precompiled header '%s'.\n", path);
+        zcc_funmap(&file);
+        return Z_EXIT_FAILURE;
+    }
+
+    zcc_pch_free();
+    zcc_pch.file = file;
+    zcc_pch.text = file.data + head->text;
+    zcc_pch.size = head->textsize;
+    zcc_pch.marks = (const struct zcc_pch_mark*)(file.data + head->marks);
+    zcc_pch.markcount = head->markcount;
+    zcc_pch.strs = file.data + head->strs;
+
+    /* macros point into the mapped strings, only tokens are rebuilt */
+    recs = (const struct zcc_pch_macro*)(file.data + head->macros);
+    toks = (const struct zcc_pch_tok*)(file.data + head->toks);
+    strs = file.data + head->strs;
+    for (i = 0; i < head->count; ++i) {
+        struct token name;
+        name.str = strs + recs[i].name;
+        name.len = (unsigned int)zstrlen(name.str);
+        name.atom = zatom_get(name.str, name.len);
+        
+        /* definitions made before loading stay */
+        if (zcc_macro_find(defines, name)) {
+            continue;
+        }
+
+        macro.str = string_empty();
+        if (recs[i].str) {
+            macro.str.data = (char*)(size_t)(strs + recs[i].str);
+            macro.str.size = recs[i].len;
+        }
+        macro.args = zcc_pch_tokens(toks + recs[i].args, recs[i].argc, macro.str.data);
+        macro.body = zcc_pch_tokens(toks + recs[i].body, recs[i].bodyc, macro.str.data);
+        zcc_defines_insert(defines, name.atom, &macro);
+    }
+
+    zcc_pch_headers((const struct zcc_pch_header*)(file.data + head->headers), head->headercount, strs);
+    return Z_EXIT_SUCCESS;
+}
+
+/* Unmaps the precompiled header once no definitions from it are used */
+void zcc_pch_free(void)
+{
+    zcc_funmap(&zcc_pch.file);
+    zcc_pch.text = NULL;
+    zcc_pch.size = 0;
+    zcc_pch.marks = NULL;
+    zcc_pch.markcount = 0;
+    zcc_pch.strs = NULL;
+}
+
+/* Marks where the text goes on after newlines were dropped, so locations
+ * still resolve to the lines of the file */
+static void zcc_text_mark(struct zsrcmap* map, const char* name, const size_t offset, const size_t line)
+{
+    struct zsrcloc loc;
+    if (map) {
+        loc.name = zsrcmap_name(map, name);
+        loc.line = line;
+        loc.column = 1;
+        zsrcmap_mark(map, offset, loc);
+    }
+}
+
+/* Strips comments and line splices in a single pass. Kept bytes are only
+ * moved once something before them was dropped, each run of them with a
+ * single copy to the write pointer. Scanning jumps from one byte that may
+ * matter to the next. */
+
+static char* zcc_text_move(char* w, const char* from, const char* to)
+{
+    if (w != from) {
+        zmemmove(w, from, to - from);
+    }
+    return w + (to - from);
+}
+
+char* zcc_preprocess_text(const char* name, char* str, size_t* size, struct zsrcmap* map)
+{
+    char* w = str;
+    const char* k = str, *r = str, *p;
+    size_t line = 1, n;
+    char quote;
+
+    while (1) {
+        r = zscan_text(r);
+        switch (*r) {
+        case 0:
+            w = zcc_text_move(w, k, r);
+            *w = 0;
+            *size = w - str;
+            return str;
         case '\n':
-            if (i > 0 && str[i - 1] == '\\') {
-                string_remove_index(&text, i--);
-                string_remove_index(&text, i--);
+            ++line;
+            /* the backslash is either still to be moved or already out */
+            if (r > k && r[-1] == '\\') {
+                w = zcc_text_move(w, k, r - 1);
+                k = ++r;
+                zcc_text_mark(map, name, w - str, line);
             }
-            ++linecount;
+            else if (r == k && w > str && w[-1] == '\\') {
+                --w;
+                k = ++r;
+                zcc_text_mark(map, name, w - str, line);
+            }
+            else ++r;
             break;
         case '"':
         case '\'':
-            /*i = zcc_lexstr(ch) - str;*/
-            ++i;
-            while (str[i] && str[i] != *ch) {
-                i += (str[i] == '\\');
-                ++i;
-            } 
-            ++i;
+            /* escapes skip any byte but line splices go here too */
+            quote = *r;
+            for (p = r + 1; *(p = zscan_quote(p, quote)) == '\\' && p[1]; p += 2) {
+                if (p[1] == '\n') {
+                    for (; r < p; ++r) {
+                        line += *r == '\n';
+                    }
+                    w = zcc_text_move(w, k, p);
+                    k = r = p + 2;
+                    zcc_text_mark(map, name, w - str, ++line);
+                }
+            }
+            p += *p == quote;
+            for (; r < p; ++r) {
+                line += *r == '\n';
+            }
             break;
         case '/':
-            if (str[i + 1] == '/') {
-                while (*ch && *ch != '\n') {
-                    ++ch;
-                }
+            if (r[1] == '/') {
+                for (p = r + 2; *(p = zscan_line(p)) == '\r'; ++p);
                 if (zcc_precomments) {
-                    string_remove_range(&text, i, i + ch - (str + i));
+                    /* the newline ending the comment is never a splice */
+                    w = zcc_text_move(w, k, r);
+                    k = r = p;
+                    if (*r) {
+                        ++line;
+                        ++r;
+                    }
                 }
-                else i = i + ch - (str + i) - 1;
-            }
-            else if (str[i + 1] == '*') {
-                ch = zstrstr(str + i + 2, "*/");
-                if (!ch) {
-                    zcc_log("Comment is not closed on line %zu.\n", linecount + 1);
-                    str[i] = 0;
-                    return text.data;
+                else r = p;
+            }
+            else if (r[1] == '*') {
+                n = 0;
+                for (p = r + 2; *(p = zscan_comment(p)) && (*p != '*' || p[1] != '/'); ++p) {
+                    n += *p == '\n';
                 }
+
+                if (!*p) {
+                    struct zsrcmap tmp = zsrcmap_create(name);
+                    w = zcc_text_move(w, k, r);
+                    *w = 0;
+                    *size = w - str;
+                    zsrcloc_log(zsrcmap_locate(map ? map : &tmp, str, w - str));
+                    zcc_log("Comment is not closed.\n");
+                    zsrcmap_free(&tmp);
+                    return str;
+                }
+
+                line += n;
                 if (zcc_precomments) {
-                    string_remove_range(&text, i + 1, i + ch - (str + i) + 2);
-                    str[i] = ' ';
+                    /* the comment becomes a single space */
+                    w = zcc_text_move(w, k, r);
+                    *w++ = ' ';
+                    k = r = p + 2;
+                    if (n) {
+                        zcc_text_mark(map, name, w - str, line);
+                    }
                 }
-                else i = i + ch - (str + i) + 1;
+                else r = p + 2;
             }
+            else ++r;
             break;
         }
     }
-
-    *size = text.size;
-    return text.data;
 }
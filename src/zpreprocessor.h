@@ -2,13 +2,46 @@
 #define ZCC_PREPROCESSOR_H
 
 #include <utopia/utopia.h>
+#include <zsource.h>
+#include <ztoken.h>
 
-struct map zcc_defines_std(void);
-int zcc_defines_push(struct map* defines, const char* keystr, const char* valstr);
-int zcc_defines_undef(struct map* defines, const char* key);
-void zcc_defines_free(struct map* defines, const size_t from);
+/* Macro definitions named by the atom of their identifier. Definitions
+ * keep the order they were made in and open addressed slots index them.
+ * A bit per atom tells names that were never defined apart without
+ * probing. A copy shares the definitions it starts with. */
+struct zmacros {
+    struct vector defs;
+    unsigned int* slots;
+    unsigned int mask;
+    unsigned char* bits;
+    size_t bitsize;
+    size_t shared;
+};
 
-char* zcc_preprocess_text(char* str, size_t* size);
-char* zcc_preprocess_macros(char* src, size_t* size, const struct map* defines, const char** includes);
+struct zmacros zcc_defines_create(void);
+struct zmacros zcc_defines_std(void);
+struct zmacros zcc_defines_copy(const struct zmacros* defines);
+int zcc_defines_push(struct zmacros* defines, const char* keystr, const char* valstr);
+int zcc_defines_undef(struct zmacros* defines, const char* key);
+void zcc_defines_free(struct zmacros* defines);
+
+/* Comments and line splices are stripped in place. When a map is given it
+ * gets marks wherever newlines were dropped, so offsets of the stripped
+ * text still resolve to lines of the file. Macro expansion reads the text
+ * and writes a new heap buffer, it takes over the map locating src and
+ * leaves one locating the output in its place. The guard of a stripped
+ * text is the atom of its include guard macro, or 0. */
+char* zcc_preprocess_text(const char* name, char* str, size_t* size, struct zsrcmap* map);
+unsigned int zcc_preprocess_guard(const char* str);
+char* zcc_preprocess_macros(struct zsrcmap* map, const char* src, size_t* size, const struct zmacros* defines, const char** includes);
+
+/* A precompiled header holds the macros defined once a header prefix is
+ * preprocessed along with its expanded text and the marks locating it.
+ * Emitting one takes over the map locating src. Loading one adds its
+ * macros to defines without lexing them again and writes its text ahead
+ * of the output of every unit. The file stays mapped until zcc_pch_free. */
+int zcc_pch_emit(const char* path, struct zsrcmap* map, const char* src, size_t* size, const struct zmacros* defines, const char** includes);
+int zcc_pch_load(const char* path, struct zmacros* defines);
+void zcc_pch_free(void);
 
 #endif /* ZCC_PREPROCESSOR_H */
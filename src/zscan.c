@@ -0,0 +1,403 @@
+#include <zscan.h>
+#include <zctype.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(ZCC_NOSIMD)
+#define ZSCAN_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+struct zscan_kernels {
+    const char* (*line)(const char*);
+    const char* (*blank)(const char*);
+    const char* (*graph)(const char*);
+    const char* (*id)(const char*);
+    const char* (*quote)(const char*, const char);
+    const char* (*text)(const char*);
+    const char* (*comment)(const char*);
+};
+
+/* Scalar fallback */
+
+static const char* zscan_line_scalar(const char* str)
+{
+    while (*str && *str != '\n' && *str != '\r') {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_blank_scalar(const char* str)
+{
+    while (*str == ' ' || *str == '\t') {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_graph_scalar(const char* str)
+{
+    while (*str && !_isgraph(*str)) {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_id_scalar(const char* str)
+{
+    while (_isalpha(*str) || _isdigit(*str) || *str == '_') {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_quote_scalar(const char* str, const char quote)
+{
+    while (*str && *str != quote && *str != '\\') {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_text_scalar(const char* str)
+{
+    while (*str && *str != '/' && *str != '"' && *str != '\'' && *str != '\n') {
+        ++str;
+    }
+    return str;
+}
+
+static const char* zscan_comment_scalar(const char* str)
+{
+    while (*str && *str != '*' && *str != '\n') {
+        ++str;
+    }
+    return str;
+}
+
+#ifdef ZSCAN_X86
+
+/* Loads are aligned down to the vector width and the bytes before str are
+ * masked out of the first block. MASK(v) yields the bits of stop bytes.
+ * Aligned loads never cross a page, but they do read around the buffer,
+ * so the kernels are left out of AddressSanitizer checks. */
+
+#define ZSCAN_KERNEL __attribute__((no_sanitize_address))
+
+#define ZSCAN_LOOP(str, width, vec, load, MASK)                     \
+    do {                                                            \
+        const size_t off = (size_t)(str) & ((width) - 1);           \
+        const vec* p = (const vec*)(size_t)((str) - off);           \
+        vec v = load(p);                                            \
+        unsigned int mask = MASK(v) & (~0U << off);                 \
+        while (!mask) {                                             \
+            v = load(++p);                                          \
+            mask = MASK(v);                                         \
+        }                                                           \
+        return (const char*)p + __builtin_ctz(mask);                \
+    } while (0)
+
+#define ZSCAN_RANGE128(v, lo, hi) _mm_and_si128(                    \
+    _mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)),                     \
+    _mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+
+#define ZSCAN_EQ128(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+
+#define ZSCAN_LINE128(v) (unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_or_si128(ZSCAN_EQ128(v, '\n'), ZSCAN_EQ128(v, '\r')),       \
+    ZSCAN_EQ128(v, 0)))
+
+#define ZSCAN_BLANK128(v) (~(unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    ZSCAN_EQ128(v, ' '), ZSCAN_EQ128(v, '\t'))) & 0xffff)
+
+#define ZSCAN_GRAPH128(v) (unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_andnot_si128(ZSCAN_EQ128(v, 0x7f), _mm_cmpgt_epi8(v, _mm_set1_epi8(' '))),  \
+    ZSCAN_EQ128(v, 0)))
+
+#define ZSCAN_ID128(v) (~(unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_or_si128(ZSCAN_RANGE128(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'),  \
+    ZSCAN_RANGE128(v, '0', '9')), ZSCAN_EQ128(v, '_'))) & 0xffff)
+
+#define ZSCAN_QUOTE128(v) (unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_or_si128(_mm_cmpeq_epi8(v, q), ZSCAN_EQ128(v, '\\')),       \
+    ZSCAN_EQ128(v, 0)))
+
+#define ZSCAN_TEXT128(v) (unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_or_si128(ZSCAN_EQ128(v, '/'), ZSCAN_EQ128(v, '"')),         \
+    _mm_or_si128(_mm_or_si128(ZSCAN_EQ128(v, '\''), ZSCAN_EQ128(v, '\n')),  \
+    ZSCAN_EQ128(v, 0))))
+
+#define ZSCAN_COMMENT128(v) (unsigned int)_mm_movemask_epi8(_mm_or_si128(  \
+    _mm_or_si128(ZSCAN_EQ128(v, '*'), ZSCAN_EQ128(v, '\n')),        \
+    ZSCAN_EQ128(v, 0)))
+
+ZSCAN_KERNEL static const char* zscan_line_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_LINE128);
+}
+
+ZSCAN_KERNEL static const char* zscan_blank_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_BLANK128);
+}
+
+ZSCAN_KERNEL static const char* zscan_graph_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_GRAPH128);
+}
+
+ZSCAN_KERNEL static const char* zscan_id_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_ID128);
+}
+
+ZSCAN_KERNEL static const char* zscan_quote_sse2(const char* str, const char quote)
+{
+    const __m128i q = _mm_set1_epi8(quote);
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_QUOTE128);
+}
+
+ZSCAN_KERNEL static const char* zscan_text_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_TEXT128);
+}
+
+ZSCAN_KERNEL static const char* zscan_comment_sse2(const char* str)
+{
+    ZSCAN_LOOP(str, 16, __m128i, _mm_load_si128, ZSCAN_COMMENT128);
+}
+
+#define ZSCAN_RANGE256(v, lo, hi) _mm256_and_si256(                 \
+    _mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)),               \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), v))
+
+#define ZSCAN_EQ256(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+
+#define ZSCAN_LINE256(v) (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_or_si256(ZSCAN_EQ256(v, '\n'), ZSCAN_EQ256(v, '\r')),    \
+    ZSCAN_EQ256(v, 0)))
+
+#define ZSCAN_BLANK256(v) ~(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    ZSCAN_EQ256(v, ' '), ZSCAN_EQ256(v, '\t')))
+
+#define ZSCAN_GRAPH256(v) (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_andnot_si256(ZSCAN_EQ256(v, 0x7f), _mm256_cmpgt_epi8(v, _mm256_set1_epi8(' '))),  \
+    ZSCAN_EQ256(v, 0)))
+
+#define ZSCAN_ID256(v) ~(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_or_si256(ZSCAN_RANGE256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'),  \
+    ZSCAN_RANGE256(v, '0', '9')), ZSCAN_EQ256(v, '_')))
+
+#define ZSCAN_QUOTE256(v) (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, q), ZSCAN_EQ256(v, '\\')), \
+    ZSCAN_EQ256(v, 0)))
+
+#define ZSCAN_TEXT256(v) (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_or_si256(ZSCAN_EQ256(v, '/'), ZSCAN_EQ256(v, '"')),      \
+    _mm256_or_si256(_mm256_or_si256(ZSCAN_EQ256(v, '\''), ZSCAN_EQ256(v, '\n')),  \
+    ZSCAN_EQ256(v, 0))))
+
+#define ZSCAN_COMMENT256(v) (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(  \
+    _mm256_or_si256(ZSCAN_EQ256(v, '*'), ZSCAN_EQ256(v, '\n')),     \
+    ZSCAN_EQ256(v, 0)))
+
+#define ZSCAN_TARGET_AVX2 __attribute__((target("avx2"), no_sanitize_address))
+
+ZSCAN_TARGET_AVX2 static const char* zscan_line_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_LINE256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_blank_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_BLANK256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_graph_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_GRAPH256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_id_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_ID256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_quote_avx2(const char* str, const char quote)
+{
+    const __m256i q = _mm256_set1_epi8(quote);
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_QUOTE256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_text_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_TEXT256);
+}
+
+ZSCAN_TARGET_AVX2 static const char* zscan_comment_avx2(const char* str)
+{
+    ZSCAN_LOOP(str, 32, __m256i, _mm256_load_si256, ZSCAN_COMMENT256);
+}
+
+static int zscan_cpu(void)
+{
+    unsigned int eax, ebx, ecx, edx, xcr0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        return ZSCAN_SSE2;
+    }
+
+    __asm__ ("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+    if ((xcr0 & 0x6) != 0x6 || __get_cpuid_max(0, NULL) < 7) {
+        return ZSCAN_SSE2;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & bit_AVX2) ? ZSCAN_AVX2 : ZSCAN_SSE2;
+}
+
+#else
+
+static int zscan_cpu(void)
+{
+    return ZSCAN_SCALAR;
+}
+
+#endif /* ZSCAN_X86 */
+
+static const char* zscan_line_init(const char* str);
+static const char* zscan_blank_init(const char* str);
+static const char* zscan_graph_init(const char* str);
+static const char* zscan_id_init(const char* str);
+static const char* zscan_quote_init(const char* str, const char quote);
+static const char* zscan_text_init(const char* str);
+static const char* zscan_comment_init(const char* str);
+
+static const struct zscan_kernels zscan_table[] = {
+    {
+        &zscan_line_scalar, 
+        &zscan_blank_scalar, 
+        &zscan_graph_scalar, 
+        &zscan_id_scalar, 
+        &zscan_quote_scalar,
+        &zscan_text_scalar,
+        &zscan_comment_scalar
+    }
+#ifdef ZSCAN_X86
+    , {
+        &zscan_line_sse2,
+        &zscan_blank_sse2,
+        &zscan_graph_sse2,
+        &zscan_id_sse2,
+        &zscan_quote_sse2,
+        &zscan_text_sse2,
+        &zscan_comment_sse2
+    }, {
+        &zscan_line_avx2,
+        &zscan_blank_avx2,
+        &zscan_graph_avx2,
+        &zscan_id_avx2,
+        &zscan_quote_avx2,
+        &zscan_text_avx2,
+        &zscan_comment_avx2
+    }
+#endif
+};
+
+/* The first call through any kernel resolves the dispatch table */
+
+static struct zscan_kernels zscan = {
+    &zscan_line_init,
+    &zscan_blank_init,
+    &zscan_graph_init,
+    &zscan_id_init,
+    &zscan_quote_init,
+    &zscan_text_init,
+    &zscan_comment_init
+};
+
+int zscan_init(const int level)
+{
+    const int max = zscan_cpu();
+    const int lvl = (level == ZSCAN_AUTO || level > max) ? max : level;
+    zscan = zscan_table[lvl < 0 ? ZSCAN_SCALAR : lvl];
+    return lvl;
+}
+
+static const char* zscan_line_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.line(str);
+}
+
+static const char* zscan_blank_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.blank(str);
+}
+
+static const char* zscan_graph_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.graph(str);
+}
+
+static const char* zscan_id_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.id(str);
+}
+
+static const char* zscan_quote_init(const char* str, const char quote)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.quote(str, quote);
+}
+
+static const char* zscan_text_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.text(str);
+}
+
+static const char* zscan_comment_init(const char* str)
+{
+    zscan_init(ZSCAN_AUTO);
+    return zscan.comment(str);
+}
+
+/* Dispatched kernels */
+
+const char* zscan_line(const char* str)
+{
+    return zscan.line(str);
+}
+
+const char* zscan_blank(const char* str)
+{
+    return zscan.blank(str);
+}
+
+const char* zscan_graph(const char* str)
+{
+    return zscan.graph(str);
+}
+
+const char* zscan_id(const char* str)
+{
+    return zscan.id(str);
+}
+
+const char* zscan_quote(const char* str, const char quote)
+{
+    return zscan.quote(str, quote);
+}
+
+const char* zscan_text(const char* str)
+{
+    return zscan.text(str);
+}
+
+const char* zscan_comment(const char* str)
+{
+    return zscan.comment(str);
+}
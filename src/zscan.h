@@ -0,0 +1,26 @@
+#ifndef ZCC_SCAN_H
+#define ZCC_SCAN_H
+
+/* Byte scanning kernels used by the lexer and the comment stripping pass
+ * of the preprocessor. Every kernel stops at the terminating NUL, so
+ * vector versions only ever issue aligned loads and never touch a page
+ * past the end of the string. zscan_text stops where a comment, literal
+ * or line splice may start, zscan_comment where a block comment or a
+ * line may end. */
+
+#define ZSCAN_AUTO -1
+#define ZSCAN_SCALAR 0
+#define ZSCAN_SSE2 1
+#define ZSCAN_AVX2 2
+
+int zscan_init(const int level);
+
+const char* zscan_line(const char* str);
+const char* zscan_blank(const char* str);
+const char* zscan_graph(const char* str);
+const char* zscan_id(const char* str);
+const char* zscan_quote(const char* str, const char quote);
+const char* zscan_text(const char* str);
+const char* zscan_comment(const char* str);
+
+#endif /* ZCC_SCAN_H */
@@ -54,13 +54,14 @@ int zsolve_tree(const struct treenode* root, long* val)
 {
     if (root) {
         const struct token* op = root->data;
-        if (op->type == ZTOK_ID || op->type == ZTOK_STR) {
-            return 0;
+        if (op->kind == ZKIND_NUM || op->kind == ZKIND_CHR) {
+            const struct zlit lit = ztokval(op);
+            *val = lit.val.i;
+            return lit.type == ZLIT_INT || lit.type == ZLIT_CHAR;
         }
 
-        if (op->type == ZTOK_NUM) {
-            *val = zatol(ztokbuf(op));
-            return 1;
+        if (op->type == ZTOK_ID || op->type == ZTOK_STR || op->type == ZTOK_DEF) {
+            return 0;
         }
 
         if (op->type == ZTOK_SYM && *root->children) {
@@ -105,62 +106,3 @@ int zsolve_precedence(const char* str)
         default: return -1;
     }
 }
-
-long zsolve_stack(const char* str)
-{
-    long out[0xff], outcount = 0, stackcount = 0, n, u = 1;
-    struct token stack[0xff], tok = ztok_get(str);
-
-    while (tok.str) {
-        zassert(!_isalpha(*tok.str));
-        switch (*tok.str) {
-            case 0:
-                break;
-            case '0': case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8': case '9':
-                out[outcount++] = zatol(tok.str);
-                u = 0;
-                break;
-            case '(':
-                stack[stackcount++] = tok;
-                ++u;
-                break;
-            case ')':
-                while (stackcount && *stack[stackcount - 1].str != '(') {
-                    if (stack[stackcount - 1].type == ZTOK_SYM_OP_UNARY) {
-                        out[outcount - 1] = zsolve_unary(out[outcount - 1], stack[--stackcount].str);
-                        continue;
-                    }
-                    n = out[--outcount];
-                    out[outcount - 1] = zsolve_binary(out[outcount - 1], n, stack[--stackcount].str);
-                }
-                stackcount = stackcount ? stackcount - 1: stackcount;
-                break;
-            default:
-                tok.type = u ? ZTOK_SYM_OP_UNARY : ZTOK_SYM_OP_RIGHT;
-                while (stackcount && *stack[stackcount - 1].str != '(' &&
-                    zsolve_precedence(tok.str) >= zsolve_precedence(stack[stackcount - 1].str)) {
-                    if (stack[stackcount - 1].type == ZTOK_SYM_OP_UNARY) {
-                        out[outcount - 1] = zsolve_unary(out[outcount - 1], stack[--stackcount].str);
-                        continue;
-                    }
-                    n = out[--outcount];
-                    out[outcount - 1] = zsolve_binary(out[outcount - 1], n, stack[--stackcount].str);
-                }
-                stack[stackcount++] = tok;
-                ++u;
-        }
-        tok = ztok_nextl(tok);
-    }
-
-    while (stackcount) {
-        if (stack[stackcount - 1].type == ZTOK_SYM_OP_UNARY) {
-            out[outcount - 1] = zsolve_unary(out[outcount - 1], stack[--stackcount].str);
-            continue;
-        }
-        n = out[--outcount];
-        out[outcount - 1] = zsolve_binary(out[outcount - 1], n, stack[--stackcount].str);
-    }
-
-    return out[0];
-}
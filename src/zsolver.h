@@ -3,7 +3,6 @@
 
 #include <utopia/tree.h>
 
-long zsolve_stack(const char* str);
 int zsolve_precedence(const char* str);
 int zsolve_tree(const struct treenode* root, long* val);
 long zsolve_binary(const long l, const long r, const char* p);
@@ -0,0 +1,156 @@
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zsource.h>
+#include <zio.h>
+
+struct zsrcmap zsrcmap_create(const char* name)
+{
+    struct zsrcmap map;
+    struct zsrcloc loc;
+    map.marks = vector_create(sizeof(struct zsrcmark));
+    map.lines = vector_create(sizeof(size_t));
+    map.names = vector_create(sizeof(char*));
+    map.indexed = 0;
+    loc.name = zsrcmap_name(&map, name);
+    loc.line = 1;
+    loc.column = 1;
+    zsrcmap_mark(&map, 0, loc);
+    return map;
+}
+
+void zsrcmap_free(struct zsrcmap* map)
+{
+    size_t i;
+    char** names = map->names.data;
+    for (i = 0; i < map->names.size; ++i) {
+        zfree(names[i]);
+    }
+    vector_free(&map->marks);
+    vector_free(&map->lines);
+    vector_free(&map->names);
+}
+
+const char* zsrcmap_name(struct zsrcmap* map, const char* name)
+{
+    size_t i;
+    char* copy;
+    char** names = map->names.data;
+    const size_t len = zstrlen(name);
+    for (i = 0; i < map->names.size; ++i) {
+        if (!zstrcmp(names[i], name)) {
+            return names[i];
+        }
+    }
+
+    copy = zmalloc(len + 1);
+    zmemcpy(copy, name, len + 1);
+    vector_push(&map->names, &copy);
+    return copy;
+}
+
+void zsrcmap_mark(struct zsrcmap* map, const size_t offset, const struct zsrcloc loc)
+{
+    size_t i;
+    struct zsrcmark* marks;
+    struct zsrcmark mark;
+    mark.offset = offset;
+    mark.line = loc.line;
+    mark.name = loc.name;
+
+    /* marks are mostly pushed in order, keep them sorted by offset */
+    marks = map->marks.data;
+    for (i = map->marks.size; i && marks[i - 1].offset > offset; --i);
+    if (i && marks[i - 1].offset == offset) {
+        marks[i - 1] = mark;
+        return;
+    }
+
+    vector_push(&map->marks, &mark);
+    marks = map->marks.data;
+    zmemmove(marks + i + 1, marks + i, (map->marks.size - i - 1) * sizeof(struct zsrcmark));
+    marks[i] = mark;
+}
+
+void zsrcmap_splice(struct zsrcmap* map, const size_t from, const size_t to, const size_t len)
+{
+    size_t i, n;
+    struct zsrcmark* marks = map->marks.data;
+    const size_t* lines = map->lines.data;
+
+    /* bytes [from, to) were replaced by len bytes, later marks move along
+     * and marks inside the replaced range are dropped. A mark at from is
+     * kept for the replacement unless a moved mark lands on it. */
+    for (i = map->marks.size; i && marks[i - 1].offset >= to; --i) {
+        marks[i - 1].offset = marks[i - 1].offset - to + from + len;
+    }
+    for (n = i; n && marks[n - 1].offset > from; --n);
+    if (!len && n && i < map->marks.size && marks[n - 1].offset == from) {
+        --n;
+    }
+    if (n < i) {
+        zmemmove(marks + n, marks + i, (map->marks.size - i) * sizeof(struct zsrcmark));
+        map->marks.size -= i - n;
+    }
+
+    /* the newline index is only valid before the first changed byte */
+    for (n = map->lines.size; n && lines[n - 1] >= from; --n);
+    map->lines.size = n;
+    if (map->indexed > from) {
+        map->indexed = from;
+    }
+}
+
+static size_t zsrcmap_rank(const struct zsrcmap* map, const size_t offset)
+{
+    size_t lo = 0, hi = map->lines.size;
+    const size_t* lines = map->lines.data;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (lines[mid] < offset) {
+            lo = mid + 1;
+        }
+        else hi = mid;
+    }
+    return lo;
+}
+
+struct zsrcloc zsrcmap_locate(struct zsrcmap* map, const char* text, const size_t offset)
+{
+    size_t lo = 0, hi = map->marks.size, rank;
+    const struct zsrcmark* marks;
+    const size_t* lines;
+    struct zsrcloc loc;
+
+    /* extend the newline index up to offset with memchr */
+    while (map->indexed < offset) {
+        const char* nl = zmemchr(text + map->indexed, '\n', offset - map->indexed);
+        if (!nl) {
+            map->indexed = offset;
+            break;
+        }
+        map->indexed = nl - text;
+        vector_push(&map->lines, &map->indexed);
+        ++map->indexed;
+    }
+
+    marks = map->marks.data;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (marks[mid].offset <= offset) {
+            lo = mid;
+        }
+        else hi = mid;
+    }
+
+    lines = map->lines.data;
+    rank = zsrcmap_rank(map, offset);
+    loc.name = marks[lo].name;
+    loc.line = marks[lo].line + rank - zsrcmap_rank(map, marks[lo].offset);
+    loc.column = offset - (rank ? lines[rank - 1] + 1 : 0) + 1;
+    return loc;
+}
+
+void zsrcloc_log(const struct zsrcloc loc)
+{
+    zcc_log("%s:%zu:%zu: ", loc.name, loc.line, loc.column);
+}
@@ -0,0 +1,39 @@
+#ifndef ZCC_SOURCE_H
+#define ZCC_SOURCE_H
+
+#include <zstddef.h>
+#include <utopia/vector.h>
+
+/* Source locations are resolved lazily. A source map holds marks telling
+ * which file and line a byte offset of a buffer comes from, plus an index
+ * of newline offsets that is only extended when a location is asked for.
+ * Offsets in between marks resolve by binary search on that index. */
+
+struct zsrcloc {
+    const char* name;
+    size_t line;
+    size_t column;
+};
+
+struct zsrcmark {
+    size_t offset;
+    size_t line;
+    const char* name;
+};
+
+struct zsrcmap {
+    struct vector marks;
+    struct vector lines;
+    struct vector names;
+    size_t indexed;
+};
+
+struct zsrcmap zsrcmap_create(const char* name);
+void zsrcmap_free(struct zsrcmap* map);
+const char* zsrcmap_name(struct zsrcmap* map, const char* name);
+void zsrcmap_mark(struct zsrcmap* map, const size_t offset, const struct zsrcloc loc);
+void zsrcmap_splice(struct zsrcmap* map, const size_t from, const size_t to, const size_t len);
+struct zsrcloc zsrcmap_locate(struct zsrcmap* map, const char* text, const size_t offset);
+void zsrcloc_log(const struct zsrcloc loc);
+
+#endif /* ZCC_SOURCE_H */
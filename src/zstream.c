@@ -0,0 +1,181 @@
+#include <zsys.h>
+#include <zstdlib.h>
+#include <zstring.h>
+#include <zlexer.h>
+#include <zstream.h>
+#include <zio.h>
+
+enum zstream_comment {
+    ZSTREAM_CODE,
+    ZSTREAM_LINE,
+    ZSTREAM_BLOCK
+};
+
+void zstream_init(struct zstream* stream, const int fd)
+{
+    stream->fd = fd;
+    stream->eof = 0;
+    stream->hold = 0;
+    stream->comment = ZSTREAM_CODE;
+    stream->capacity = ZSTREAM_CHUNK;
+    stream->buf = zmalloc(stream->capacity + 1);
+    stream->buf[0] = 0;
+    stream->begin = 0;
+    stream->end = 0;
+}
+
+int zstream_open(struct zstream* stream, const char* path)
+{
+    int fd = zcc_fopen(path);
+    if (fd < 0) {
+        return Z_EXIT_FAILURE;
+    }
+    zstream_init(stream, fd);
+    return Z_EXIT_SUCCESS;
+}
+
+void zstream_close(struct zstream* stream)
+{
+    zcc_fclose(stream->fd);
+    zfree(stream->buf);
+    stream->buf = NULL;
+    stream->fd = -1;
+}
+
+/* Removes backslash newline pairs from str[from, end) in place */
+static size_t zstream_splice(char* str, size_t from, const size_t end)
+{
+    size_t r, w;
+    const char* bs = zmemchr(str + from, '\\', end - from);
+    if (!bs) {
+        return end;
+    }
+
+    for (r = w = bs - str; r < end; ++r) {
+        if (str[r] == '\\' && r + 1 < end && str[r + 1] == '\n') {
+            ++r;
+            continue;
+        }
+        str[w++] = str[r];
+    }
+    return w;
+}
+
+/* Moves the unconsumed bytes to the front of the window and reads the next
+ * chunk after them. A trailing backslash is held back until the next read
+ * since it may start a splice. Pointers into the window are invalidated. */
+static void zstream_fill(struct zstream* stream)
+{
+    long n;
+    size_t from, len = stream->end - stream->begin;
+
+    if (stream->begin) {
+        zmemmove(stream->buf, stream->buf + stream->begin, len);
+        stream->begin = 0;
+        stream->end = len;
+    }
+
+    if (stream->end + stream->hold == stream->capacity) {
+        stream->capacity *= 2;
+        stream->buf = zrealloc(stream->buf, stream->capacity + 1);
+    }
+
+    from = stream->end;
+    if (stream->hold) {
+        stream->buf[stream->end++] = '\\';
+        stream->hold = 0;
+    }
+
+    n = (long)zread(stream->fd, stream->buf + stream->end, stream->capacity - stream->end);
+    if (n <= 0) {
+        stream->eof = 1;
+        stream->buf[stream->end] = 0;
+        return;
+    }
+
+    stream->end = zstream_splice(stream->buf, from, stream->end + (size_t)n);
+    if (stream->end > from && stream->buf[stream->end - 1] == '\\') {
+        stream->hold = 1;
+        --stream->end;
+    }
+    stream->buf[stream->end] = 0;
+}
+
+/* Skips the rest of a comment, returns 0 if more input is needed */
+static int zstream_comment(struct zstream* stream)
+{
+    const char* str = stream->buf + stream->begin, *end = stream->buf + stream->end;
+    if (stream->comment == ZSTREAM_LINE) {
+        const char* nl = zmemchr(str, '\n', end - str);
+        if (!nl) {
+            stream->begin = stream->end;
+            return 0;
+        }
+        stream->begin = nl - stream->buf;
+        stream->comment = ZSTREAM_CODE;
+        return 1;
+    }
+
+    while ((str = zmemchr(str, '*', end - str))) {
+        if (str + 1 == end) {
+            break;
+        }
+        if (str[1] == '/') {
+            stream->begin = str + 2 - stream->buf;
+            stream->comment = ZSTREAM_CODE;
+            return 1;
+        }
+        ++str;
+    }
+
+    /* keep a last '*' that could close the comment with the next chunk */
+    stream->begin = stream->end - (stream->end > stream->begin && end[-1] == '*');
+    return 0;
+}
+
+struct token zstream_next(struct zstream* stream)
+{
+    char* end;
+    const char* str;
+    unsigned int type;
+    struct token tok = {NULL, 0, ZTOK_NULL, ZKIND_NULL, 0};
+
+    while (1) {
+        if (stream->comment != ZSTREAM_CODE) {
+            if (!zstream_comment(stream)) {
+                if (stream->eof) {
+                    break;
+                }
+                zstream_fill(stream);
+            }
+            continue;
+        }
+
+        str = stream->buf + stream->begin;
+        if (*str == '/' && (str[1] == '/' || str[1] == '*')) {
+            stream->comment = str[1] == '/' ? ZSTREAM_LINE : ZSTREAM_BLOCK;
+            stream->begin += 2;
+            continue;
+        }
+
+        /* a token reaching the end of the window may go on in the next
+         * chunk, read more and lex it again from its start. The lexer
+         * looks one byte ahead for "..", so a byte short counts too. */
+        end = zlex_next(str, &type);
+        if ((!end || stream->buf + stream->end - end < 2) && !stream->eof) {
+            zstream_fill(stream);
+            continue;
+        }
+
+        if (!end) {
+            break;
+        }
+
+        stream->begin = end - stream->buf;
+        if (type != ZTOK_NON) {
+            return ztokget(str, end, type);
+        }
+    }
+
+    return tok;
+}
@@ -0,0 +1,33 @@
+#ifndef ZCC_STREAM_H
+#define ZCC_STREAM_H
+
+#include <zstddef.h>
+#include <ztoken.h>
+
+/* Streaming lexer over a file read in fixed size chunks. Only the current
+ * window is kept in memory, which grows past ZSTREAM_CHUNK only to hold a
+ * single token longer than that. Tokens crossing a chunk boundary are
+ * completed by reading on, comments are skipped and line splices removed
+ * as the text goes by. A token stays valid until the next zstream_next. */
+
+#ifndef ZSTREAM_CHUNK
+#define ZSTREAM_CHUNK 0x10000
+#endif
+
+struct zstream {
+    int fd;
+    int eof;
+    int hold;
+    int comment;
+    char* buf;
+    size_t capacity;
+    size_t begin;
+    size_t end;
+};
+
+int zstream_open(struct zstream* stream, const char* path);
+void zstream_init(struct zstream* stream, const int fd);
+void zstream_close(struct zstream* stream);
+struct token zstream_next(struct zstream* stream);
+
+#endif /* ZCC_STREAM_H */
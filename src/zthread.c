@@ -0,0 +1,99 @@
+/* Kept apart from the rest of the sources since the thread glue needs the
+ * system headers instead of zlibc's. */
+
+#ifdef ZCC_THREADS
+
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <unistd.h>
+#include <zthread.h>
+
+#ifndef ZTHREAD_MAX
+#define ZTHREAD_MAX 64
+#endif
+
+static pthread_mutex_t zthread_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct zthread_task {
+    void (*func)(void*);
+    void* arg;
+};
+
+static void* zthread_main(void* arg)
+{
+    struct zthread_task* task = arg;
+    task->func(task->arg);
+    return NULL;
+}
+
+unsigned int zthread_count(void)
+{
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > ZTHREAD_MAX ? ZTHREAD_MAX : (unsigned int)n;
+}
+
+void zthread_run(void (*func)(void*), void** args, const unsigned int count)
+{
+    unsigned int i;
+    const unsigned int n = count < ZTHREAD_MAX ? count : ZTHREAD_MAX;
+    pthread_t threads[ZTHREAD_MAX];
+    struct zthread_task tasks[ZTHREAD_MAX];
+    int started[ZTHREAD_MAX];
+
+    for (i = 1; i < n; ++i) {
+        tasks[i].func = func;
+        tasks[i].arg = args[i];
+        started[i] = !pthread_create(threads + i, NULL, &zthread_main, tasks + i);
+    }
+
+    /* the calling thread takes the first task, any task past ZTHREAD_MAX
+     * and any task that could not get a thread of its own */
+    for (i = 0; i < count; ++i) {
+        if (!i || i >= n || !started[i]) {
+            func(args[i]);
+        }
+    }
+
+    for (i = 1; i < n; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+void zthread_lock(void)
+{
+    pthread_mutex_lock(&zthread_mutex);
+}
+
+void zthread_unlock(void)
+{
+    pthread_mutex_unlock(&zthread_mutex);
+}
+
+#else
+
+#include <zthread.h>
+
+unsigned int zthread_count(void)
+{
+    return 1;
+}
+
+void zthread_run(void (*func)(void*), void** args, const unsigned int count)
+{
+    unsigned int i;
+    for (i = 0; i < count; ++i) {
+        func(args[i]);
+    }
+}
+
+void zthread_lock(void)
+{
+}
+
+void zthread_unlock(void)
+{
+}
+
+#endif /* ZCC_THREADS */
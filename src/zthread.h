@@ -0,0 +1,14 @@
+#ifndef ZCC_THREAD_H
+#define ZCC_THREAD_H
+
+/* Minimal fork join helpers. Threads are only used when built with
+ * ZCC_THREADS, otherwise the work runs in order on the calling thread.
+ * This header includes nothing so it can sit next to either zlibc or the
+ * system headers. */
+
+unsigned int zthread_count(void);
+void zthread_run(void (*func)(void*), void** args, const unsigned int count);
+void zthread_lock(void);
+void zthread_unlock(void);
+
+#endif /* ZCC_THREAD_H */
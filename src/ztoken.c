@@ -1,11 +1,81 @@
 #include <zstdlib.h>
 #include <zstring.h>
+#include <zassert.h>
 #include <zlexer.h>
 #include <ztoken.h>
+#include <zatom.h>
+#include <zkindhash.h>
 
+#define ZKIND_STR(name, str) str,
+
+static const char* zkind_strs[ZKIND_COUNT] = {
+    "", "identifier", "number", "string", "character", "symbol",
+    ZKIND_KEYWORDS(ZKIND_STR)
+    ZKIND_PUNCTUATORS(ZKIND_STR)
+};
+
+#undef ZKIND_STR
+
+const char* zkind_str(const unsigned int kind)
+{
+    return kind < ZKIND_COUNT ? zkind_strs[kind] : "";
+}
+
+unsigned int zkind_type(const unsigned int kind)
+{
+    switch (kind) {
+        case ZKIND_NULL: return ZTOK_NULL;
+        case ZKIND_ID: return ZTOK_ID;
+        case ZKIND_NUM: return ZTOK_NUM;
+        case ZKIND_STR: 
+        case ZKIND_CHR: return ZTOK_STR;
+    }
+    return zkind_iskeyword(kind) ? ZTOK_ID : ZTOK_SYM;
+}
+
+unsigned int zkind_lookup(const char* str, const unsigned int len)
+{
+    unsigned int kind, i;
+    const char* match;
+    const unsigned char* s = (const unsigned char*)str;
+    if (!len || len > ZKIND_HASH_MAXLEN) {
+        return ZKIND_NULL;
+    }
+
+    /* the candidate may be shorter than len, stop at its NUL */
+    kind = zkind_hash_table[ZKIND_HASH(s, len)];
+    match = zkind_strs[kind];
+    for (i = 0; i < len && match[i] == str[i]; ++i);
+    return kind && i == len && !match[len] ? kind : ZKIND_NULL;
+}
+
+unsigned int zkind_classify(const char* str, const unsigned int len, const unsigned int type)
+{
+    unsigned int kind;
+    switch (type) {
+        case ZTOK_ID:
+            kind = zkind_lookup(str, len);
+            return zkind_iskeyword(kind) ? kind : ZKIND_ID;
+        case ZTOK_NUM:
+            return ZKIND_NUM;
+        case ZTOK_STR:
+            return *str == '"' ? ZKIND_STR : ZKIND_CHR;
+        case ZTOK_SYM:
+            kind = zkind_lookup(str, len);
+            return kind ? kind : ZKIND_SYM;
+    }
+    return ZKIND_NULL;
+}
+
+/* The buffer only grows, long joined strings would overflow a fixed one */
 char* ztokbuf(const struct token* token)
 {
-    static char buf[0xff];
+    static char* buf = NULL;
+    static size_t size = 0;
+    if (token->len >= size) {
+        size = token->len + 0x100;
+        buf = zrealloc(buf, size);
+    }
     zmemcpy(buf, token->str, token->len);
     buf[token->len] = 0;
     return buf;
@@ -17,6 +87,8 @@ struct token ztokget(const char* start, const char* end, unsigned int type)
     token.str = start;
     token.len = end - start;
     token.type = type;
+    token.kind = zkind_classify(start, token.len, type);
+    token.atom = type == ZTOK_ID ? zatom_get(start, token.len) : 0;
     return token;
 }
 
@@ -36,12 +108,46 @@ struct token ztoknext(const char* str)
 
 struct token ztoknum(const long n)
 {
+    char buf[0x20];
     struct token tok;
-    char* str = zmalloc(0xf);
-    tok.type = ZTOK_DEF;
-    tok.len = zltoa(n, str, 10);
-    tok.str = str;
-    return tok;
+    struct zlit lit;
+    lit.val.i = n;
+    lit.type = ZLIT_INT;
+    lit.flags = 0;
+    tok.str = buf;
+    tok.len = zltoa(n, buf, 10);
+    tok.type = ZTOK_NUM;
+    tok.kind = ZKIND_NUM;
+    tok.atom = 0;
+    return ztoklit(&tok, &lit);
+}
+
+/* A ZTOK_DEF literal holds its spelling and a NUL, then its value at the
+ * next multiple of the value size. See ztokval. */
+
+#define ZTOK_LIT_OFFSET(len) (((len) / sizeof(struct zlit) + 1) * sizeof(struct zlit))
+
+struct token ztoklit(const struct token* tok, const struct zlit* lit)
+{
+    struct token def = *tok;
+    const size_t offset = ZTOK_LIT_OFFSET(tok->len);
+    char* buf = zmalloc(offset + sizeof(struct zlit));
+    zmemcpy(buf, tok->str, tok->len);
+    buf[tok->len] = 0;
+    zmemcpy(buf + offset, lit, sizeof(struct zlit));
+    def.str = buf;
+    def.type = ZTOK_DEF;
+    return def;
+}
+
+struct zlit ztokval(const struct token* tok)
+{
+    struct zlit lit;
+    if (tok->type == ZTOK_DEF && (tok->kind == ZKIND_NUM || tok->kind == ZKIND_CHR)) {
+        zmemcpy(&lit, tok->str + ZTOK_LIT_OFFSET(tok->len), sizeof(struct zlit));
+        return lit;
+    }
+    return zlit_decode(tok->str, tok->len);
 }
 
 struct token ztokstr(const char* str)
@@ -50,6 +156,8 @@ struct token ztokstr(const char* str)
     struct token tok;
     tok.type = ZTOK_DEF;
     tok.len = zstrlen(str);
+    tok.kind = zkind_lookup(str, tok.len);
+    tok.atom = 0;
     buf = zmalloc(tok.len + 1);
     zmemcpy(buf, str, tok.len);
     buf[tok.len] = 0;
@@ -57,21 +165,379 @@ struct token ztokstr(const char* str)
     return tok;
 }
 
-struct token ztokappend(const struct token* t1, const struct token* t2)
+/* Decodes the escape sequences of the len bytes of a literal body at src
+ * into dst, which needs room for len bytes. Returns the decoded size. */
+
+size_t zstr_decode(char* dst, const char* src, const size_t len)
 {
-    char* buf;
-    struct token tok;
-    tok.type = ZTOK_DEF;
-    tok.len = t1->len + t2->len - 2;
-    buf = zmalloc(tok.len + 1);
-    zmemcpy(buf, t1->str, t1->len - 1);
-    zmemcpy(buf + t1->len - 1, t2->str + 1, t2->len - 1);
-    buf[tok.len] = 0;
+    int n;
+    unsigned int c;
+    const char* end = src + len;
+    char* out = dst;
+    while (src < end) {
+        if (*src != '\\' || src + 1 == end) {
+            *out++ = *src++;
+            continue;
+        }
+
+        switch (*++src) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'v': c = '\v'; break;
+            case 'x':
+                for (c = 0; src + 1 < end && _isxdigit(src[1]); ++src) {
+                    n = src[1];
+                    c = c * 16 + (_isdigit(n) ? n - '0' : (n | 0x20) - 'a' + 10);
+                }
+                break;
+            case '0': case '1': case '2': case '3':
+            case '4': case '5': case '6': case '7':
+                c = *src - '0';
+                for (n = 1; n < 3 && src + 1 < end && src[1] >= '0' && src[1] <= '7'; ++n) {
+                    c = c * 8 + *++src - '0';
+                }
+                break;
+            default: c = (unsigned char)*src;
+        }
+        *out++ = (char)c;
+        ++src;
+    }
+    return out - dst;
+}
+
+/* Number and character literal decoding */
+
+static int zlit_digit(const int c)
+{
+    if (_isdigit(c)) {
+        return c - '0';
+    }
+    return _isalpha(c) ? (c | 0x20) - 'a' + 10 : 0x7f;
+}
+
+static double zlit_scale(double f, const int base, long exp)
+{
+    double b = base, p = 1.0;
+    const int neg = exp < 0;
+    exp = neg ? -exp : exp;
+    while (exp) {
+        if (exp & 1) {
+            p *= b;
+        }
+        b *= b;
+        exp >>= 1;
+    }
+    return neg ? f / p : f * p;
+}
+
+static void zlit_suffix(struct zlit* lit, const char* s, const char* end)
+{
+    unsigned int flag;
+    for (; s < end; ++s) {
+        switch (*s) {
+            case 'u': case 'U': flag = ZLIT_UNSIGNED; break;
+            case 'l': case 'L': flag = lit->flags & ZLIT_LONG ? ZLIT_LONGLONG : ZLIT_LONG; break;
+            case 'f': case 'F': flag = lit->type == ZLIT_REAL ? ZLIT_FLOAT : 0; break;
+            default: flag = 0;
+        }
+        if (!flag || (lit->flags & flag)) {
+            lit->type = ZLIT_BAD;
+            return;
+        }
+        lit->flags |= flag;
+    }
+}
+
+/* Decimal and hexadecimal floating constants, a hexadecimal one needs its
+ * binary exponent */
+static void zlit_real(struct zlit* lit, const char* s, const char* end, const int base)
+{
+    int d, neg;
+    long exp = 0, e = 0;
+    double f = 0.0;
+    lit->type = ZLIT_REAL;
+
+    for (; s < end && (d = zlit_digit(*s)) < base; ++s) {
+        f = f * base + d;
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && (d = zlit_digit(*s)) < base; ++s) {
+            f = f * base + d;
+            --exp;
+        }
+    }
+
+    if (s < end && (*s | 0x20) == (base == 16 ? 'p' : 'e')) {
+        ++s;
+        neg = s < end && *s == '-';
+        s += s < end && (*s == '-' || *s == '+');
+        if (s == end || !_isdigit(*s)) {
+            lit->type = ZLIT_BAD;
+            return;
+        }
+        for (; s < end && _isdigit(*s); ++s) {
+            e = e < 0xffff ? e * 10 + *s - '0' : e;
+        }
+        e = neg ? -e : e;
+    }
+    else if (base == 16) {
+        lit->type = ZLIT_BAD;
+        return;
+    }
+
+    lit->val.f = base == 16 ? zlit_scale(zlit_scale(f, 16, exp), 2, e) : zlit_scale(f, 10, exp + e);
+    zlit_suffix(lit, s, end);
+}
+
+/* A single character is a char converted to int, several are packed into
+ * an int from the first one down as gcc and clang do */
+static void zlit_char(struct zlit* lit, const char* str, const unsigned int len)
+{
+    char buf[0x10];
+    size_t i, n;
+    lit->type = ZLIT_CHAR;
+    if (len < 3 || str[len - 1] != '\'' || len - 2 > sizeof(buf)) {
+        lit->type = ZLIT_BAD;
+        return;
+    }
+
+    n = zstr_decode(buf, str + 1, len - 2);
+    if (n == 1) {
+        lit->val.i = (signed char)buf[0];
+        return;
+    }
+
+    for (i = 0; i < n; ++i) {
+        lit->val.u = (lit->val.u << 8) | (unsigned char)buf[i];
+    }
+    lit->val.i = (int)lit->val.u;
+}
+
+struct zlit zlit_decode(const char* str, const unsigned int len)
+{
+    int d, base = 10;
+    struct zlit lit;
+    const char* s = str, *p, *end = str + len;
+    lit.val.u = 0;
+    lit.type = ZLIT_INT;
+    lit.flags = 0;
+
+    if (!len) {
+        lit.type = ZLIT_BAD;
+        return lit;
+    }
+
+    if (*s == '\'') {
+        zlit_char(&lit, str, len);
+        return lit;
+    }
+
+    if (len > 1 && *s == '0' && (s[1] | 0x20) == 'x') {
+        base = 16;
+        s += 2;
+    }
+
+    for (p = s; p < end && zlit_digit(*p) < base; ++p);
+    if (p < end && (*p == '.' || (*p | 0x20) == (base == 16 ? 'p' : 'e'))) {
+        zlit_real(&lit, s, end, base);
+        return lit;
+    }
+
+    if (p == s && base == 16) {
+        lit.type = ZLIT_BAD;
+        return lit;
+    }
+
+    base = base == 10 && *s == '0' ? 8 : base;
+    for (; s < p; ++s) {
+        d = zlit_digit(*s);
+        if (d >= base) {
+            lit.type = ZLIT_BAD;
+            return lit;
+        }
+        lit.val.u = lit.val.u * base + d;
+    }
+
+    zlit_suffix(&lit, p, end);
+    return lit;
+}
+
+/* Joins the run of adjacent string literals toks[from, to) into a single
+ * ZTOK_DEF token with one allocation. The buffer holds the joined spelling
+ * and a NUL, then the size of the decoded contents as a size_t and the
+ * decoded bytes themselves, NUL terminated. See ztokdata. */
+
+static unsigned int ztok_strbody(const struct token* tok)
+{
+    return tok->len - 1 - (tok->len > 1 && tok->str[tok->len - 1] == '"');
+}
+
+struct token ztoks_strcat(const struct tokarray* toks, const unsigned int from, const unsigned int to)
+{
+    unsigned int i, len = 2;
+    size_t size = 0;
+    char* buf, *data;
+    struct token tok, piece;
+
+    for (i = from; i < to; ++i) {
+        piece = ztoks_at(toks, i);
+        len += ztok_strbody(&piece);
+    }
+
+    buf = zmalloc(2 * len + sizeof(size_t));
+    data = buf + len + 1 + sizeof(size_t);
     tok.str = buf;
+    tok.len = len;
+    tok.type = ZTOK_DEF;
+    tok.kind = ZKIND_STR;
+    tok.atom = 0;
+
+    *buf++ = '"';
+    for (i = from; i < to; ++i) {
+        piece = ztoks_at(toks, i);
+        len = ztok_strbody(&piece);
+        zmemcpy(buf, piece.str + 1, len);
+        size += zstr_decode(data + size, buf, len);
+        buf += len;
+    }
     
-    if (t1->type == ZTOK_DEF) {
-        zfree((void*)(size_t)t1->str);
+    *buf++ = '"';
+    *buf++ = 0;
+    data[size] = 0;
+    zmemcpy(buf, &size, sizeof(size_t));
+    return tok;
+}
+
+const char* ztokdata(const struct token* tok, size_t* size)
+{
+    const char* p = tok->str + tok->len + 1;
+    zmemcpy(size, p, sizeof(size_t));
+    return p + sizeof(size_t);
+}
+
+/* Structure of arrays token storage */
+
+struct tokarray ztoks_create(const char* src)
+{
+    struct tokarray toks;
+    toks.src = src;
+    toks.offsets = NULL;
+    toks.lens = NULL;
+    toks.kinds = NULL;
+    toks.atoms = NULL;
+    toks.size = 0;
+    toks.capacity = 0;
+    toks.lits = NULL;
+    toks.litindex = NULL;
+    toks.litsize = 0;
+    toks.litcapacity = 0;
+    return toks;
+}
+
+void ztoks_push(struct tokarray* toks, const struct token* tok)
+{
+    zassert(tok->type != ZTOK_DEF && tok->str >= toks->src);
+    if (toks->size == toks->capacity) {
+        toks->capacity = toks->capacity ? toks->capacity * 2 : 0x100;
+        toks->offsets = zrealloc(toks->offsets, toks->capacity * sizeof(unsigned int));
+        toks->lens = zrealloc(toks->lens, toks->capacity * sizeof(unsigned short));
+        toks->kinds = zrealloc(toks->kinds, toks->capacity * sizeof(unsigned short));
+        toks->atoms = zrealloc(toks->atoms, toks->capacity * sizeof(unsigned int));
     }
 
+    toks->offsets[toks->size] = (unsigned int)(tok->str - toks->src);
+    toks->lens[toks->size] = tok->len < ZTOK_LEN_MAX ? tok->len : ZTOK_LEN_MAX;
+    toks->kinds[toks->size] = tok->kind;
+    toks->atoms[toks->size] = tok->atom;
+
+    if (tok->kind == ZKIND_NUM || tok->kind == ZKIND_CHR) {
+        if (toks->litsize == toks->litcapacity) {
+            toks->litcapacity = toks->litcapacity ? toks->litcapacity * 2 : 0x40;
+            toks->lits = zrealloc(toks->lits, toks->litcapacity * sizeof(struct zlit));
+            toks->litindex = zrealloc(toks->litindex, toks->litcapacity * sizeof(unsigned int));
+        }
+        toks->lits[toks->litsize] = zlit_decode(tok->str, tok->len);
+        toks->litindex[toks->litsize] = toks->size;
+        ++toks->litsize;
+    }
+    ++toks->size;
+}
+
+/* Makes room for at least size tokens and litsize literals */
+void ztoks_reserve(struct tokarray* toks, const unsigned int size, const unsigned int litsize)
+{
+    if (size > toks->capacity) {
+        toks->capacity = size;
+        toks->offsets = zrealloc(toks->offsets, toks->capacity * sizeof(unsigned int));
+        toks->lens = zrealloc(toks->lens, toks->capacity * sizeof(unsigned short));
+        toks->kinds = zrealloc(toks->kinds, toks->capacity * sizeof(unsigned short));
+        toks->atoms = zrealloc(toks->atoms, toks->capacity * sizeof(unsigned int));
+    }
+
+    if (litsize > toks->litcapacity) {
+        toks->litcapacity = litsize;
+        toks->lits = zrealloc(toks->lits, toks->litcapacity * sizeof(struct zlit));
+        toks->litindex = zrealloc(toks->litindex, toks->litcapacity * sizeof(unsigned int));
+    }
+}
+
+/* Appends the tokens of src, which must index the same text as toks */
+void ztoks_append(struct tokarray* toks, const struct tokarray* src)
+{
+    unsigned int i;
+    zassert(toks->src == src->src);
+    ztoks_reserve(toks, toks->size + src->size, toks->litsize + src->litsize);
+    zmemcpy(toks->offsets + toks->size, src->offsets, src->size * sizeof(unsigned int));
+    zmemcpy(toks->lens + toks->size, src->lens, src->size * sizeof(unsigned short));
+    zmemcpy(toks->kinds + toks->size, src->kinds, src->size * sizeof(unsigned short));
+    zmemcpy(toks->atoms + toks->size, src->atoms, src->size * sizeof(unsigned int));
+    zmemcpy(toks->lits + toks->litsize, src->lits, src->litsize * sizeof(struct zlit));
+    for (i = 0; i < src->litsize; ++i) {
+        toks->litindex[toks->litsize + i] = src->litindex[i] + toks->size;
+    }
+    toks->size += src->size;
+    toks->litsize += src->litsize;
+}
+
+struct token ztoks_at(const struct tokarray* toks, const unsigned int index)
+{
+    struct token tok;
+    tok.str = toks->src + toks->offsets[index];
+    tok.len = toks->lens[index];
+    tok.kind = toks->kinds[index];
+    tok.atom = toks->atoms[index];
+    tok.type = zkind_type(tok.kind);
+    if (tok.len == ZTOK_LEN_MAX) {
+        unsigned int type;
+        tok.len = zlex_next(tok.str, &type) - tok.str;
+    }
     return tok;
 }
+
+const struct zlit* ztoks_lit(const struct tokarray* toks, const unsigned int index)
+{
+    unsigned int lo = 0, hi = toks->litsize;
+    while (lo < hi) {
+        const unsigned int mid = lo + (hi - lo) / 2;
+        if (toks->litindex[mid] < index) {
+            lo = mid + 1;
+        }
+        else hi = mid;
+    }
+    return lo < toks->litsize && toks->litindex[lo] == index ? toks->lits + lo : NULL;
+}
+
+void ztoks_free(struct tokarray* toks)
+{
+    zfree(toks->lits);
+    zfree(toks->litindex);
+    zfree(toks->offsets);
+    zfree(toks->lens);
+    zfree(toks->kinds);
+    zfree(toks->atoms);
+    *toks = ztoks_create(NULL);
+}
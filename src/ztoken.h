@@ -20,19 +20,135 @@
 #define ZTOK_SYM_OP_RIGHT (ZTOK_SYM | ZTOK_SYM_OP | ZTOK_SYM_RIGHT)
 #define ZTOK_SYM_OP_UNARY (ZTOK_SYM | ZTOK_SYM_OP | ZTOK_SYM_UNARY)
 
+/* Token kinds, assigned once at lex time. Keywords and punctuators are
+ * looked up with a perfect hash generated from these lists at build time. */
+
+#define ZKIND_KEYWORDS(X)                                                   \
+    X(AUTO, "auto") X(BREAK, "break") X(CASE, "case") X(CHAR, "char")       \
+    X(CONST, "const") X(CONTINUE, "continue") X(DEFAULT, "default")         \
+    X(DO, "do") X(DOUBLE, "double") X(ELSE, "else") X(ENUM, "enum")         \
+    X(EXTERN, "extern") X(FLOAT, "float") X(FOR, "for") X(GOTO, "goto")     \
+    X(IF, "if") X(INT, "int") X(LONG, "long") X(REGISTER, "register")       \
+    X(RETURN, "return") X(SHORT, "short") X(SIGNED, "signed")               \
+    X(SIZEOF, "sizeof") X(STATIC, "static") X(STRUCT, "struct")             \
+    X(SWITCH, "switch") X(TYPEDEF, "typedef") X(UNION, "union")             \
+    X(UNSIGNED, "unsigned") X(VOID, "void") X(VOLATILE, "volatile")         \
+    X(WHILE, "while")
+
+#define ZKIND_PUNCTUATORS(X)                                                \
+    X(LBRACKET, "[") X(RBRACKET, "]") X(LPAREN, "(") X(RPAREN, ")")         \
+    X(LBRACE, "{") X(RBRACE, "}") X(DOT, ".") X(ARROW, "->")                \
+    X(INC, "++") X(DEC, "--") X(AMP, "&") X(STAR, "*") X(PLUS, "+")         \
+    X(MINUS, "-") X(TILDE, "~") X(NOT, "!") X(SLASH, "/") X(PERCENT, "%")   \
+    X(SHL, "<<") X(SHR, ">>") X(LT, "<") X(GT, ">") X(LE, "<=") X(GE, ">=") \
+    X(EQ, "==") X(NE, "!=") X(XOR, "^") X(OR, "|") X(LAND, "&&")            \
+    X(LOR, "||") X(QUESTION, "?") X(COLON, ":") X(SEMICOLON, ";")           \
+    X(ELLIPSIS, "...") X(ASSIGN, "=") X(MUL_ASSIGN, "*=")                   \
+    X(DIV_ASSIGN, "/=") X(MOD_ASSIGN, "%=") X(ADD_ASSIGN, "+=")             \
+    X(SUB_ASSIGN, "-=") X(SHL_ASSIGN, "<<=") X(SHR_ASSIGN, ">>=")           \
+    X(AND_ASSIGN, "&=") X(XOR_ASSIGN, "^=") X(OR_ASSIGN, "|=")              \
+    X(COMMA, ",") X(HASH, "#") X(HASHHASH, "##")
+
+#define ZKIND_ENUM(name, str) ZKIND_##name,
+
+enum zkind {
+    ZKIND_NULL,
+    ZKIND_ID,
+    ZKIND_NUM,
+    ZKIND_STR,
+    ZKIND_CHR,
+    ZKIND_SYM,
+    ZKIND_KEYWORDS(ZKIND_ENUM)
+    ZKIND_PUNCTUATORS(ZKIND_ENUM)
+    ZKIND_COUNT
+};
+
+#undef ZKIND_ENUM
+
+#define zkind_iskeyword(kind) ((kind) >= ZKIND_AUTO && (kind) <= ZKIND_WHILE)
+
+/* Identifiers carry the atom of their spelling, see zatom.h. Any other
+ * token has atom 0. */
 struct token {
     const char* str;
     unsigned int len;
-    unsigned int type;
+    unsigned short type;
+    unsigned short kind;
+    unsigned int atom;
+};
+
+/* Values of number and character literals. Integers keep their suffix
+ * flags, floating constants are doubles and character constants hold the
+ * int value of their decoded bytes. Malformed literals are ZLIT_BAD. */
+
+#define ZLIT_INT 0x00
+#define ZLIT_REAL 0x01
+#define ZLIT_CHAR 0x02
+#define ZLIT_BAD 0x03
+
+#define ZLIT_UNSIGNED 0x01
+#define ZLIT_LONG 0x02
+#define ZLIT_LONGLONG 0x04
+#define ZLIT_FLOAT 0x08
+
+struct zlit {
+    union {
+        long i;
+        unsigned long u;
+        double f;
+    } val;
+    unsigned short type;
+    unsigned short flags;
+};
+
+/* Compact token storage, 12 bytes per token kept as a structure of arrays:
+ * a 32-bit offset into src, a 16-bit length, a 16-bit kind and a 32-bit
+ * atom. The token type follows from the kind. Longer tokens store
+ * ZTOK_LEN_MAX and get their length back by lexing them again. Number
+ * and character literals are decoded as they are pushed, their values
+ * are kept aside with the index of their token. */
+
+#define ZTOK_LEN_MAX 0xffff
+
+struct tokarray {
+    const char* src;
+    unsigned int* offsets;
+    unsigned short* lens;
+    unsigned short* kinds;
+    unsigned int* atoms;
+    unsigned int size;
+    unsigned int capacity;
+    struct zlit* lits;
+    unsigned int* litindex;
+    unsigned int litsize;
+    unsigned int litcapacity;
 };
 
 #define tokend(tok) ((char*)(size_t)tok.str + tok.len)
 
+unsigned int zkind_lookup(const char* str, const unsigned int len);
+unsigned int zkind_classify(const char* str, const unsigned int len, const unsigned int type);
+const char* zkind_str(const unsigned int kind);
+unsigned int zkind_type(const unsigned int kind);
+
 struct token ztokstr(const char* str);
 struct token ztoknum(const long n);
+struct token ztoklit(const struct token* tok, const struct zlit* lit);
+struct zlit ztokval(const struct token* tok);
+struct zlit zlit_decode(const char* str, const unsigned int len);
 struct token ztoknext(const char* str);
 struct token ztokget(const char* start, const char* end, unsigned int type);
-struct token ztokappend(const struct token* t1, const struct token* t2);
 char* ztokbuf(const struct token* token);
+const char* ztokdata(const struct token* tok, size_t* size);
+size_t zstr_decode(char* dst, const char* src, const size_t len);
+
+struct tokarray ztoks_create(const char* src);
+void ztoks_push(struct tokarray* toks, const struct token* tok);
+void ztoks_reserve(struct tokarray* toks, const unsigned int size, const unsigned int litsize);
+void ztoks_append(struct tokarray* toks, const struct tokarray* src);
+struct token ztoks_at(const struct tokarray* toks, const unsigned int index);
+const struct zlit* ztoks_lit(const struct tokarray* toks, const unsigned int index);
+void ztoks_free(struct tokarray* toks);
+struct token ztoks_strcat(const struct tokarray* toks, const unsigned int from, const unsigned int to);
 
 #endif /* ZCC_TOKEN_H */
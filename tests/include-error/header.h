@@ -0,0 +1,10 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+/* Lines of an included header must not shift
+ * the lines reported for the file including it. */
+int header_var;
+
+int header_err = ;
+
+#endif /* HEADER_H */
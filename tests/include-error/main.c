@@ -0,0 +1,7 @@
+#include "header.h"
+#include "header.h"
+#define VALUE 1
+
+int main_err = ;
+int value = VALUE
+int after;
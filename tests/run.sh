@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Runs zcc on main.c of each test directory and compares the diagnostics
+# it reports with expected.txt next to it. Usage: tests/run.sh [zcc]
+
+zcc=$(realpath "${1:-./zcc}")
+root=$(dirname "$0")
+status=0
+
+for dir in "$root"/*/
+do
+    name=$(basename "$dir")
+    out=$(cd "$dir" && "$zcc" main.c 2>&1 | grep -E '^[^ ]+:[0-9]+:[0-9]+: ')
+    if [ "$out" == "$(cat "$dir/expected.txt")" ]
+    then
+        echo "pass $name"
+    else
+        echo "FAIL $name"
+        diff <(echo "$out") "$dir/expected.txt"
+        status=1
+    fi
+done
+
+exit $status
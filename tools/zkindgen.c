@@ -0,0 +1,82 @@
+/* Generates the perfect hash used by zkind_lookup from the keyword and
+ * punctuator lists in ztoken.h. Runs on the build host at build time:
+ *
+ *     zkindgen > tmp/zkindhash.h
+ *
+ * The hash is (len + s[0] * M1 + s[len - 1] * M2 + s[len / 2] * M3) masked
+ * to a power of two table size; the smallest collision-free table wins. */
+
+#include <stdio.h>
+#include <string.h>
+#include <ztoken.h>
+
+#define ZKIND_KEY(name, str) {str, ZKIND_##name},
+
+static const struct zkey {
+    const char* str;
+    int kind;
+} keys[] = {
+    ZKIND_KEYWORDS(ZKIND_KEY)
+    ZKIND_PUNCTUATORS(ZKIND_KEY)
+    {NULL, ZKIND_NULL}
+};
+
+static unsigned int zkindgen_hash(const char* s, unsigned int m1, unsigned int m2, unsigned int m3, unsigned int size)
+{
+    const unsigned int len = (unsigned int)strlen(s);
+    const unsigned char* u = (const unsigned char*)s;
+    return (len + u[0] * m1 + u[len - 1] * m2 + u[len >> 1] * m3) & (size - 1);
+}
+
+static int zkindgen_try(unsigned char* table, unsigned int m1, unsigned int m2, unsigned int m3, unsigned int size)
+{
+    int i;
+    memset(table, 0, size);
+    for (i = 0; keys[i].str; ++i) {
+        const unsigned int h = zkindgen_hash(keys[i].str, m1, m2, m3, size);
+        if (table[h]) {
+            return 0;
+        }
+        table[h] = (unsigned char)keys[i].kind;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    static unsigned char table[1024];
+    unsigned int size, m1, m2, m3, i, maxlen = 0;
+
+    for (i = 0; keys[i].str; ++i) {
+        const unsigned int len = (unsigned int)strlen(keys[i].str);
+        maxlen = len > maxlen ? len : maxlen;
+    }
+
+    for (size = 64; size <= sizeof(table); size <<= 1) {
+        for (m1 = 1; m1 < 64; ++m1) {
+            for (m2 = 1; m2 < 64; ++m2) {
+                for (m3 = 0; m3 < 64; ++m3) {
+                    if (zkindgen_try(table, m1, m2, m3, size)) {
+                        goto found;
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "zkindgen: could not find a perfect hash\n");
+    return 1;
+
+found:
+    printf("/* Generated by tools/zkindgen.c, do not edit */\n\n");
+    printf("#ifndef ZCC_KINDHASH_H\n#define ZCC_KINDHASH_H\n\n");
+    printf("#define ZKIND_HASH_SIZE %u\n", size);
+    printf("#define ZKIND_HASH_MAXLEN %u\n\n", maxlen);
+    printf("#define ZKIND_HASH(s, len) (((len) + (s)[0] * %uU + (s)[(len) - 1] * %uU + (s)[(len) >> 1] * %uU) & %uU)\n\n", m1, m2, m3, size - 1);
+    printf("static const unsigned char zkind_hash_table[ZKIND_HASH_SIZE] = {");
+    for (i = 0; i < size; ++i) {
+        printf("%s%3u%s", i % 16 ? "" : "\n    ", table[i], i + 1 < size ? "," : "\n");
+    }
+    printf("};\n\n#endif /* ZCC_KINDHASH_H */\n");
+    return 0;
+}